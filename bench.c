@@ -0,0 +1,311 @@
+// Benchmarks of the editor core on generated files, printed as JSON
+
+#include "kilo.h"
+
+/*** defines ***/
+#define BENCH_MIN_NS 200000000LL // run each benchmark for at least this long
+#define BENCH_MAX_ROWS 100000 // rows a row benchmark goes through, so a log stays mostly spans
+#define BENCH_BATCH 1024 // rows rendered at once before timing their syntax
+#define BENCH_SCREEN_ROWS 50
+#define BENCH_SCREEN_COLS 160
+
+/*** data ***/
+struct benchCorpus {
+    char *name;
+    char *suffix; // picks the syntax
+    int lines;
+    int quick_lines;
+    void (*line)(FILE *fp, int n);
+    char *path;
+    size_t bytes;
+};
+
+struct benchResult {
+    long long ns;
+    size_t bytes;
+    int runs;
+};
+
+/*** prototypes ***/
+static void benchLongLine(FILE *fp, int n);
+static void benchTabLine(FILE *fp, int n);
+static void benchKeywordLine(FILE *fp, int n);
+static void benchLogLine(FILE *fp, int n);
+
+struct benchCorpus CORPORA[] = {
+    {"long_lines", ".c", 2000, 200, benchLongLine, NULL, 0},
+    {"heavy_tabs", ".c", 300000, 20000, benchTabLine, NULL, 0},
+    {"keywords", ".c", 300000, 20000, benchKeywordLine, NULL, 0},
+    {"log_10m", ".log", 10000000, 100000, benchLogLine, NULL, 0},
+};
+#define BENCH_CORPORA (sizeof(CORPORA) / sizeof(CORPORA[0]))
+
+unsigned int BENCH_SEED = 2463534242u;
+
+/*** corpora ***/
+
+// xorshift32, the same corpus on every run
+static unsigned int benchRand(){
+    BENCH_SEED ^= BENCH_SEED << 13;
+    BENCH_SEED ^= BENCH_SEED >> 17;
+    BENCH_SEED ^= BENCH_SEED << 5;
+    return BENCH_SEED;
+}
+
+static char *benchWords[] = {
+    "count", "buf", "len", "row", "next", "state", "(", ")", "=", "+",
+    "1024", "\"text\"", "x", "->", "ptr", ";", "[", "]", "size_t", "0x7f",
+};
+#define BENCH_WORDS (sizeof(benchWords) / sizeof(benchWords[0]))
+
+static void benchLongLine(FILE *fp, int n){
+    int len = 4000 + benchRand() % 4000;
+    int col = 0;
+    (void) n;
+    while(col < len){
+        char *word = benchWords[benchRand() % BENCH_WORDS];
+        col += fprintf(fp, "%s ", word);
+    }
+    if(benchRand() % 8 == 0){
+        fputs("// trailing comment", fp);
+    }
+    fputc('\n', fp);
+}
+
+static void benchTabLine(FILE *fp, int n){
+    int depth = 1 + benchRand() % 6;
+    int words = 2 + benchRand() % 6;
+    int i;
+    for(i = 0; i < depth; i++){
+        fputc('\t', fp);
+    }
+    for(i = 0; i < words; i++){
+        fputs(benchWords[benchRand() % BENCH_WORDS], fp);
+        fputc(benchRand() % 2 ? '\t' : ' ', fp);
+    }
+    if(n % 50 == 0){
+        fputs("/* block\n\t\tcomment */", fp);
+    }
+    fputc('\n', fp);
+}
+
+static void benchKeywordLine(FILE *fp, int n){
+    static int keywords = 0;
+    int words = 8 + benchRand() % 8;
+    int i;
+    (void) n;
+    if(keywords == 0){
+        while(C_HL_keywords[keywords]) keywords++;
+    }
+    fputs("    ", fp);
+    for(i = 0; i < words; i++){
+        // Mostly keywords, with separators between them
+        if(benchRand() % 4){
+            char **kw = &C_HL_keywords[benchRand() % keywords];
+            int len = strlen(*kw);
+            if((*kw)[len - 1] == '|') len--;
+            fprintf(fp, "%.*s", len, *kw);
+        } else {
+            fputs(benchWords[benchRand() % BENCH_WORDS], fp);
+        }
+        fputc(i % 3 == 2 ? ';' : ' ', fp);
+    }
+    fputc('\n', fp);
+}
+
+static void benchLogLine(FILE *fp, int n){
+    static char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    fprintf(fp, "2026-10-17T%02d:%02d:%02d.%03d %-5s worker-%u request %d took %ums\n",
+            n / 3600000 % 24, n / 60000 % 60, n / 1000 % 60, n % 1000,
+            levels[benchRand() % 6], benchRand() % 16, n, benchRand() % 2000);
+}
+
+// Write a corpus out to a temporary file named for its syntax
+static void benchCorpusWrite(struct benchCorpus *corpus, int quick){
+    char path[] = "/tmp/kilo_bench_XXXXXX.xxxx";
+    int suffix_len = strlen(corpus->suffix);
+    strcpy(&path[strlen(path) - 5], corpus->suffix);
+    int fd = mkstemps(path, suffix_len);
+    if(fd == -1){
+        die("mkstemps");
+    }
+    FILE *fp = fdopen(fd, "w");
+    if(fp == NULL){
+        die("fdopen");
+    }
+    int lines = quick ? corpus->quick_lines : corpus->lines;
+    int n;
+    for(n = 0; n < lines; n++){
+        corpus->line(fp, n);
+    }
+    corpus->bytes = ftell(fp);
+    if(fclose(fp) == EOF){
+        die("write");
+    }
+    corpus->path = strdup(path);
+}
+
+/*** benchmarks ***/
+
+static long long benchNow(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Open the file and index every line
+static size_t benchOpen(struct benchCorpus *corpus, long long *ns){
+    long long start = benchNow();
+    editorOpen(corpus->path);
+    editorRowsIndexAll();
+    *ns = benchNow() - start;
+    return corpus->bytes;
+}
+
+// Rows the row benchmarks go through
+static int benchRows(){
+    return CONFIG.numrows < BENCH_MAX_ROWS ? CONFIG.numrows : BENCH_MAX_ROWS;
+}
+
+// Rebuild render of each row, as after an edit
+static size_t benchUpdateRow(struct benchCorpus *corpus, long long *ns){
+    size_t bytes = 0;
+    int rows = benchRows();
+    int i;
+    (void) corpus;
+    long long start = benchNow();
+    for(i = 0; i < rows; i++){
+        erow *row = editorRowAt(i);
+        editorUpdateRow(row);
+        editorRowRender(row);
+        bytes += row->size + 1;
+    }
+    *ns = benchNow() - start;
+    return bytes;
+}
+
+// Highlight the rows top to bottom, each from the state the one above left
+static size_t benchSyntax(struct benchCorpus *corpus, long long *ns){
+    size_t bytes = 0;
+    int rows = benchRows();
+    int state = 0;
+    int i, j;
+    (void) corpus;
+    *ns = 0;
+    for(i = 0; i < rows; i += BENCH_BATCH){
+        erow *batch[BENCH_BATCH];
+        int n = rows - i < BENCH_BATCH ? rows - i : BENCH_BATCH;
+        // Highlighting needs render, which is not what is being measured
+        for(j = 0; j < n; j++){
+            batch[j] = editorRowAt(i + j);
+            editorRowRender(batch[j]);
+        }
+        long long start = benchNow();
+        for(j = 0; j < n; j++){
+            state = editorUpdateSyntax(batch[j], state);
+            bytes += batch[j]->size + 1;
+        }
+        *ns += benchNow() - start;
+    }
+    return bytes;
+}
+
+// Write the whole file out and wait for the saver thread
+static size_t benchSave(struct benchCorpus *corpus, long long *ns){
+    long long start = benchNow();
+    editorSave();
+    editorSaveWait();
+    *ns = benchNow() - start;
+    return corpus->bytes;
+}
+
+// Draw page after page into the frame
+static size_t benchDraw(struct benchCorpus *corpus, long long *ns){
+    size_t bytes = 0;
+    int rows = benchRows();
+    (void) corpus;
+    long long start = benchNow();
+    for(CONFIG.rowoff = 0; CONFIG.rowoff < rows; CONFIG.rowoff += CONFIG.screenrows){
+        int y;
+        for(y = 0; y < CONFIG.screen_lines; y++){
+            CONFIG.next_frame[y].len = 0;
+            CONFIG.next_frame[y].cols = 0;
+        }
+        editorDrawRows();
+        // Only what fits on the screen, long lines are cut
+        for(y = 0; y < CONFIG.screenrows && CONFIG.rowoff + y < CONFIG.numrows; y++){
+            int len = editorRowAt(CONFIG.rowoff + y)->rsize;
+            bytes += (len < CONFIG.screencols ? len : CONFIG.screencols) + 1;
+        }
+    }
+    *ns = benchNow() - start;
+    CONFIG.rowoff = 0;
+    return bytes;
+}
+
+struct benchFunction {
+    char *name;
+    size_t (*run)(struct benchCorpus *corpus, long long *ns);
+};
+
+// In this order, the ones after open need the file open
+struct benchFunction BENCHMARKS[] = {
+    {"editorOpen", benchOpen},
+    {"editorUpdateRow", benchUpdateRow},
+    {"editorUpdateSyntax", benchSyntax},
+    {"editorDrawRows", benchDraw},
+    {"editorSave", benchSave},
+};
+#define BENCH_FUNCTIONS (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+// Repeat a benchmark for at least BENCH_MIN_NS
+static struct benchResult benchRun(struct benchFunction *bench, struct benchCorpus *corpus){
+    struct benchResult result = {0, 0, 0};
+    while(result.runs == 0 || result.ns < BENCH_MIN_NS){
+        long long ns;
+        result.bytes += bench->run(corpus, &ns);
+        result.ns += ns;
+        result.runs++;
+    }
+    return result;
+}
+
+/*** init ***/
+int main(int argc, char *argv[]){
+    int quick = argc >= 2 && !strcmp(argv[1], "quick");
+    if(argc >= 2 && !quick){
+        fprintf(stderr, "Usage: %s [quick]\n", argv[0]);
+        return 1;
+    }
+
+    // The core without a terminal, on a screen of a fixed size
+    initEditor();
+    JOURNAL.disabled = 1;
+    CONFIG.screenrows = BENCH_SCREEN_ROWS;
+    CONFIG.screencols = BENCH_SCREEN_COLS;
+    editorScreenResize();
+
+    printf("{\n  \"quick\": %s,\n  \"results\": [", quick ? "true" : "false");
+    unsigned int c, b;
+    int first = 1;
+    for(c = 0; c < BENCH_CORPORA; c++){
+        struct benchCorpus *corpus = &CORPORA[c];
+        benchCorpusWrite(corpus, quick);
+        for(b = 0; b < BENCH_FUNCTIONS; b++){
+            struct benchResult result = benchRun(&BENCHMARKS[b], corpus);
+            double seconds = result.ns / 1e9;
+            printf("%s\n    {\"corpus\": \"%s\", \"function\": \"%s\", \"file_bytes\": %zu, "
+                   "\"runs\": %d, \"bytes\": %zu, \"seconds\": %.6f, \"mb_per_s\": %.2f}",
+                   first ? "" : ",", corpus->name, BENCHMARKS[b].name, corpus->bytes,
+                   result.runs, result.bytes, seconds, result.bytes / 1e6 / seconds);
+            fflush(stdout);
+            first = 0;
+        }
+        // Close the file before it goes away
+        editorRowsFree();
+        unlink(corpus->path);
+        free(corpus->path);
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -1,86 +1,6 @@
 // Step 165
 
-/*** include ***/
-#include <ctype.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdarg.h>
-#include <string.h>
-#include <sys/ioctl.h>
-#include <sys/types.h>
-#include <termios.h>
-#include <time.h>
-#include <unistd.h>
-
-/*** defines ***/
-#define KILO_VERSION "0.0.1"
-#define KILO_TAB_STOP 8
-#define KILO_QUIT_TIMES 3
-
-#define HL_HIGHLIGHT_NUMBERS (1<<0)
-#define HL_HIGHLIGHT_STRINGS (1<<1)
-
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
-
-#define CTRL_KEY(k) ((k) & 0x1f) // Binary & operation
-
-enum editorKey {
-    BACKSPACE = 127,
-    ARROW_LEFT = 1000,
-    ARROW_RIGHT,
-    ARROW_UP,
-    ARROW_DOWN,
-    DEL_KEY,
-    HOME_KEY,
-    END_KEY,
-    PAGE_UP,
-    PAGE_DOWN
-};
-
-enum editorHighlight {
-    HL_NORMAL = 0,
-    HL_COMMENT,
-    HL_KEYWORD1,
-    HL_KEYWORD2,
-    HL_STRING,
-    HL_NUMBER,
-    HL_MATCH
-};
-/*** data ***/
-struct editorSyntax{
-    char* filetype;
-    char** filematch;
-    char** keywords;
-    char* singleline_comment_start;
-    int flags;
-};
-//Editor row, counts size of chars and a buffer of chars
-typedef struct erow{
-    int size;
-    int rsize;
-    char* chars;
-    char* render;
-    unsigned char *hl;
-} erow;
-
-struct editorConfig {
-    int cx, cy; //cursor x, cursor y
-    int rx; // index into render field
-    int rowoff; // row offset, what rowoff of the file the user is currently on
-    int coloff; // column offset
-    int screenrows;
-    int screencols;
-    int numrows;
-    erow *row; //editor can have multiple buffer rows
-    int dirty;
-    char *filename;
-    char statusmsg[80];
-    time_t statusmsg_time;
-    struct editorSyntax *syntax;
-    struct termios orig_termios;
-};
+#include "kilo.h"
 
 /*** filetypes ***/
 char* C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
@@ -96,105 +16,46 @@ struct editorSyntax HLDB[] = {
     {  "c",
        C_HL_extensions,
        C_HL_keywords,
-       "//",
-       HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+       "//", "/*", "*/",
+       HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+       NULL, 0, 0
     },
                               
 };
-/*** types ***/
-// Append buffer
-// change name to be slightly more meaningful, we're not code golfing this
-struct abuf {
-    char *buf;
-    int len;
-};
-// Constructor for our append buffer
-#define ABUF_INIT {NULL, 0}
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+/*** data ***/
 
 struct editorConfig CONFIG;
 
-/*** Prototypes ***/
-void editorSetStatusMessage(const char* fmt, ...);
-void editorRefreshScreen();
-
-/*** terminal ***/
-void enableRawMode();
-void disableRawMode();
-int editorReadKey();
-void editorProcessKeyPress();
-int getCursorPosition(int *rows, int *cols);
-int getWindowSize(int * rows, int *cols);
-
-/*** syntax highlighting ***/
-void editorUpdateSyntax(erow *row);
-int editorSyntaxToColor(int hl);
-int is_seperator(int c);
-void editorSelectSyntaxHighlight();
-
-/*** file i/o ***/
-char* editorRowsToString(int *buflen);
-void editorOpen(char* filename);
-void editorSave();
-
-/*** append buffer ***/
-void abAppend(struct abuf *ab, const char* string, int len);
-void abFree(struct abuf *ab);
-
-/*** find ***/
-void editorFindCallback(char *query, int key);
-void editorFind();
-
-/*** output ***/
-void editorRefreshScreen();
-void editorDrawStatusBar(struct abuf *ab);
-void editorDrawRows(struct abuf *ab);
-void editorScroll();
-void editorDrawMessageBar(struct abuf *ab);
-
-/*** row operations ***/
-void editorUpdateRow(erow *row);
-void editorAppendRow(char* s, size_t len);
-void editorFreeRow(erow *row);
-void editorDelRow(int at);
-int editorRowCxToRx(erow * row, int cx);
-int editorRowRxToCx(erow *row, int rx);
-void editorRowInsertChar(erow *row, int at, int input);
-void editorRowDelChar(erow *row, int at);
-void editorRowAppendString(erow *row, char *s, size_t len);
-
-/*** editor operations ***/
-void editorInsertChar(int input);
-void editorDelChar();
-void editorInsertNewline();
-
-/*** input ***/
-void editorMoveCursor(int key);
-char *editorPrompt(char* prompt,void (*callback)(char *, int));
-
-/*** init ***/
-void initEditor();
-
-// error handling
-
-void die(const char *s);
+// is_seperator() for every byte, filled in by editorSyntaxCompile()
+unsigned char SEPARATORS[256];
+struct attrEscape ATTR_ESCAPES[256];
+// Display width of every code point, 2 bits each. WIDTH_INDEX picks a block
+// of 256 code points out of WIDTH_BLOCKS, which holds each distinct block
+// once, see editorWidthInit()
+unsigned char WIDTH_INDEX[0x110000 >> 8];
+unsigned char WIDTH_BLOCKS[256][64];
+// Output of a frame, kept between frames so redraws don't allocate
+struct abuf FRAME_OUT = ABUF_INIT;
+struct editorSearch SEARCH;
+struct editorLexer LEXER;
+struct editorSaver SAVER;
+struct editorJournal JOURNAL;
+struct editorUndo UNDO;
+struct editorReplay REPLAY;
 
 /*** init ***/
-int main(int argc, char *argv[]) {
-    enableRawMode();
-    initEditor();
-
-    if(argc >= 2){
-        editorOpen(argv[1]); // pass in the first argument as a filename
-    }
-
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-f = find");
-    // Read 1 byte at a time
+void editorRun(){
     while(1){
-        editorRefreshScreen();
+        // Keys that arrived together are all handled before drawing again
+        if(editorInputPending()){
+            editorScroll();
+        } else {
+            editorRefreshScreen();
+        }
         editorProcessKeyPress();
     }
-    return 0;
 }
 
 /*** terminal ***/
@@ -216,14 +77,18 @@ void enableRawMode(){
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 
     raw.c_cc[VMIN] = 0; // Value sets minimum number of bytes of input needed before read() can return. Set so it returns right away
-    raw.c_cc[VTIME] = 1; // Maximum amount of time read waits to return, in tenths of seconds
+    raw.c_cc[VTIME] = 0; // Never wait in read(), editorWait() polls for input instead
 
     if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1){
         die("tcsetattr");
     }
+
+    // Bracketed paste, pasted text arrives between \x1b[200~ and \x1b[201~
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
 void disableRawMode(){
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if(tcsetattr(STDERR_FILENO,TCSAFLUSH, &CONFIG.orig_termios) == -1){
         die("tcsetattrint");
     }
@@ -238,46 +103,119 @@ void die(const char *s){
     exit(1);
 }
 
-int editorReadKey(){
+/*
+ * Read whatever input is available into CONFIG.input, keeping the bytes not
+ * decoded yet. Waits up to timeout_ms for some to arrive, -1 waits for good.
+ * Returns the number of bytes read, or -1 once the input has ended.
+ */
+static int inputFill(int timeout_ms){
+    int polled = 0;
+    if(timeout_ms != 0 && !REPLAY.active){
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if(poll(&pfd, 1, timeout_ms) <= 0){
+            return 0;
+        }
+        polled = 1;
+    }
+    if(CONFIG.input_pos > 0){
+        memmove(CONFIG.input, &CONFIG.input[CONFIG.input_pos], CONFIG.input_len - CONFIG.input_pos);
+        CONFIG.input_len -= CONFIG.input_pos;
+        CONFIG.input_pos = 0;
+    }
     int nread;
-    char input;
+    if(REPLAY.active){
+        nread = editorReplayRead(&CONFIG.input[CONFIG.input_len], sizeof(CONFIG.input) - CONFIG.input_len, timeout_ms);
+        if(nread == -1) return -1;
+    } else {
+        nread = read(STDIN_FILENO, &CONFIG.input[CONFIG.input_len], sizeof(CONFIG.input) - CONFIG.input_len);
+    }
+    if(nread == -1 && errno != EAGAIN){
+        die("read");
+    }
+    if(nread <= 0){
+        // Readable yet nothing to read is end of file or a hangup
+        return nread == 0 && polled ? -1 : 0;
+    }
+    CONFIG.input_len += nread;
+    return nread;
+}
+
+// Next input byte, or -1 if none came within timeout_ms
+static int inputNext(int timeout_ms){
+    if(CONFIG.input_pos == CONFIG.input_len && inputFill(timeout_ms) <= 0){
+        return -1;
+    }
+    return (unsigned char) CONFIG.input[CONFIG.input_pos++];
+}
+
+/*
+ * Whether more input is already waiting to be decoded
+ */
+int editorInputPending(){
+    return CONFIG.input_pos < CONFIG.input_len;
+}
+
+int editorReadKey(){
+    int input;
+
+    while((input = inputNext(0)) == -1) {
+        // Sleep until something happens, unless there is idle work left
+        int events = editorWait(editorRowsIndexed() ? editorTimerNext() : 0);
+        if(events & EVENT_INPUT) continue;
 
-    while((nread = read(STDIN_FILENO, &input, 1)) != 1) {
-        if(nread == -1 && errno != EAGAIN) {
-            die("read");
+        int fired = editorTimersExpire();
+        if(fired & (1 << TIMER_JOURNAL)){
+            editorJournalSync();
+        }
+        int redraw = (events & EVENT_RESIZE) || (fired & ~(1 << TIMER_JOURNAL));
+        if(events & EVENT_SEARCH){
+            redraw |= editorFindProgress();
+        }
+        if(events & EVENT_SYNTAX){
+            redraw |= editorSyntaxPending();
+        }
+        if(events & EVENT_SAVE){
+            redraw |= editorSaveFinish();
+        }
+        redraw |= editorFileCheck();
+        if(editorIdle() || redraw){
+            editorRefreshScreen();
         }
     }
 
     // '\x1b' = 27
     if(input == '\x1b'){
-        char seq[3];
-        //??
-        if (read(STDIN_FILENO, &seq[0], 1) != 1){
+        int seq0 = inputNext(KILO_ESC_TIMEOUT_MS);
+        if(seq0 == -1){
             return '\x1b';
         }
-
-        if (read(STDIN_FILENO, &seq[1], 1) != 1){
+        int seq1 = inputNext(KILO_ESC_TIMEOUT_MS);
+        if(seq1 == -1){
             return '\x1b';
         }
 
-        if(seq[0] == '['){
-            if(seq[1] >= '0' && seq[1] <= '9'){
-                if(read(STDIN_FILENO, &seq[2], 1) !=1){
-                    return '\x1b';
+        if(seq0 == '['){
+            if(seq1 >= '0' && seq1 <= '9'){
+                // Numbered keys are digits up to a '~'
+                int number = seq1 - '0';
+                int next;
+                while((next = inputNext(KILO_ESC_TIMEOUT_MS)) >= '0' && next <= '9'){
+                    number = number * 10 + next - '0';
                 }
-                if(seq[2] == '~'){
-                    switch (seq[1]){
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                if(next == '~'){
+                    switch (number){
+                        case 1: return HOME_KEY;
+                        case 3: return DEL_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200: return PASTE_START;
                     }
                 }
             } else {
-                switch (seq[1]) {
+                switch (seq1) {
                     case 'A': return ARROW_UP;
                     case 'B': return ARROW_DOWN;
                     case 'C': return ARROW_RIGHT;
@@ -286,8 +224,8 @@ int editorReadKey(){
                     case 'F': return END_KEY;
                 }
             }
-        } else if (seq[0] == '0'){
-            switch(seq[1]){
+        } else if (seq0 == 'O'){
+            switch(seq1){
                 case 'H': return HOME_KEY;
                 case 'F': return END_KEY;
             }
@@ -298,22 +236,37 @@ int editorReadKey(){
     }
 }
 
+// Typing and backspace edit at the gap of the row being typed into, every
+// other key may look at whole rows
+static int keyKeepsGap(int key){
+    return key == BACKSPACE || key == CTRL_KEY('h') || (key >= 32 && key < ARROW_LEFT);
+}
+
 void editorProcessKeyPress(){
     static int quit_times = KILO_QUIT_TIMES;
     int input = editorReadKey();
 
+    if(!keyKeepsGap(input)){
+        editorRowGapClose();
+    }
+    // Typing and backspacing carry on the undo step in progress
+    editorUndoCommand(keyKeepsGap(input));
+
     switch(input) {
     case '\r':
         editorInsertNewline();
         break;
 
     case CTRL_KEY('q'):
+        // A save still being written decides whether anything is unsaved
+        editorSaveWait();
         if(CONFIG.dirty && quit_times > 0) {
             // Clear screen and exit on quit
             editorSetStatusMessage("WARNING!!! File has unstaved changes. Press Ctrl-Q %d more times to quit.", quit_times);
             quit_times--;
             return;
         }
+        editorJournalDiscard();
         write(STDOUT_FILENO, "\x1b[2J", 4);
         write(STDOUT_FILENO, "\x1b[H", 3);
         exit(0);
@@ -323,19 +276,39 @@ void editorProcessKeyPress(){
         editorSave();
         break;
 
+    case CTRL_KEY('z'):
+        editorUndo();
+        break;
+
+    case CTRL_KEY('y'):
+        editorRedo();
+        break;
+
     case HOME_KEY:
         CONFIG.cx =0;
         break;
 
     case END_KEY:
         if(CONFIG.cy < CONFIG.numrows){
-            CONFIG.cx = CONFIG.row[CONFIG.cy].size;
+            CONFIG.cx = editorRowAt(CONFIG.cy)->size;
         }
         break;
     case CTRL_KEY('f'): {
         editorFind();
         break;
     }
+    case CTRL_KEY('g'):
+        editorGotoLine();
+        break;
+    case CTRL_KEY('b'):
+        editorGotoOffset();
+        break;
+    case CTRL_KEY('t'):
+        CONFIG.show_stats = !CONFIG.show_stats;
+        break;
+    case PASTE_START:
+        editorPaste();
+        break;
     case BACKSPACE:
     case CTRL_KEY('h'):
     case DEL_KEY:
@@ -348,6 +321,7 @@ void editorProcessKeyPress(){
             if(input == PAGE_UP){
                 CONFIG.cy = CONFIG.rowoff;
             } else if (input == PAGE_DOWN){
+                editorRowsEnsure(CONFIG.rowoff + CONFIG.screenrows);
                 CONFIG.cy = CONFIG.rowoff + CONFIG.screenrows - 1;
                 if(CONFIG.cy > CONFIG.numrows){
                     CONFIG.cy = CONFIG.numrows;
@@ -390,7 +364,9 @@ int getCursorPosition(int *rows, int *cols) {
     }
 
     while (i < sizeof(buf) - 1) {
-        if(read(STDIN_FILENO, &buf[i], 1) != 1){
+        // Reads don't wait in raw mode, give the terminal a moment to answer
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if(poll(&pfd, 1, 1000) <= 0 || read(STDIN_FILENO, &buf[i], 1) != 1){
             break;
         }
 
@@ -424,7 +400,7 @@ int getWindowSize(int *rows, int *cols){
     // If we can't for some reason find screen resolution, or get some wonky
     // value try moving the cursor to the bottom right else set rows and cols
     // accordingly
-    if(1 || ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0){
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0){
         // If we fail to process 12 bites return -1
         // 999C and 999B mean go as far right and as far down as you can
         if(write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12){
@@ -440,10 +416,139 @@ int getWindowSize(int *rows, int *cols){
     }
 }
 
+/*** events ***/
+static long long nowMs(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void handleSigwinch(int sig){
+    (void) sig;
+    int saved_errno = errno;
+    write(CONFIG.signal_pipe[1], "w", 1);
+    errno = saved_errno;
+}
+
+/*
+ * Set up the pipe signal handlers use to wake the event loop, and listen
+ * for window size changes
+ */
+void editorEventsInit(){
+    if(pipe(CONFIG.signal_pipe) == -1){
+        die("pipe");
+    }
+    int i;
+    for(i = 0; i < 2; i++){
+        fcntl(CONFIG.signal_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(CONFIG.signal_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigwinch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGWINCH, &sa, NULL) == -1){
+        die("sigaction");
+    }
+}
+
+static void eventsResize(){
+    int rows, cols;
+    if(getWindowSize(&rows, &cols) == -1) return;
+    CONFIG.screenrows = rows - 2;
+    CONFIG.screencols = cols;
+}
+
+/*
+ * Block until there is input, the window was resized, a background thread
+ * made progress, or timeout_ms went by
+ * (-1 waits for good). Returns the EVENT_* bits that happened.
+ */
+int editorWait(int timeout_ms){
+    struct pollfd fds[2] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {CONFIG.signal_pipe[0], POLLIN, 0},
+    };
+    if(poll(fds, 2, timeout_ms) == -1){
+        if(errno == EINTR) return 0;
+        die("poll");
+    }
+
+    int events = 0;
+    if(fds[0].revents & POLLIN){
+        events |= EVENT_INPUT;
+    } else if(fds[0].revents & (POLLHUP | POLLERR)){
+        die("poll");
+    }
+    if(fds[1].revents & POLLIN){
+        // Each writer leaves a byte saying what happened
+        char drain[64];
+        int n;
+        while((n = read(CONFIG.signal_pipe[0], drain, sizeof(drain))) > 0){
+            if(memchr(drain, 'w', n)) events |= EVENT_RESIZE;
+            if(memchr(drain, 's', n)) events |= EVENT_SEARCH;
+            if(memchr(drain, 'h', n)) events |= EVENT_SYNTAX;
+            if(memchr(drain, 'S', n)) events |= EVENT_SAVE;
+            if(memchr(drain, 'b', n)) events |= EVENT_FILE;
+        }
+        if(events & EVENT_RESIZE){
+            eventsResize();
+        }
+    }
+    return events;
+}
+
+/*
+ * Make a timer fire ms from now
+ */
+void editorTimerSet(int timer, int ms){
+    CONFIG.timers[timer] = nowMs() + ms;
+}
+
+int editorTimerPending(int timer){
+    return CONFIG.timers[timer] && CONFIG.timers[timer] > nowMs();
+}
+
+/*
+ * Milliseconds until the next timer fires, -1 if none is set
+ */
+int editorTimerNext(){
+    long long now = nowMs();
+    long long next = -1;
+    int i;
+    for(i = 0; i < TIMER_COUNT; i++){
+        if(CONFIG.timers[i] == 0) continue;
+        long long left = CONFIG.timers[i] > now ? CONFIG.timers[i] - now : 0;
+        if(next == -1 || left < next){
+            next = left;
+        }
+    }
+    return next;
+}
+
+/*
+ * Clear the timers that are due, returns a bit (1 << timer) for each
+ */
+int editorTimersExpire(){
+    long long now = nowMs();
+    int fired = 0;
+    int i;
+    for(i = 0; i < TIMER_COUNT; i++){
+        if(CONFIG.timers[i] && CONFIG.timers[i] <= now){
+            CONFIG.timers[i] = 0;
+            fired |= 1 << i;
+        }
+    }
+    return fired;
+}
+
 /*** syntax highlighting ***/
 int editorSyntaxToColor(int hl) {
     switch(hl){
-    case HL_COMMENT: return 36;
+    case HL_COMMENT:
+    case HL_MLCOMMENT: return 36;
     case HL_KEYWORD1: return 33;
     case HL_KEYWORD2: return 32;
     case HL_STRING: return 35;
@@ -453,42 +558,91 @@ int editorSyntaxToColor(int hl) {
     }
 }
 
-void editorUpdateSyntax(erow *row){
-    row->hl = realloc(row->hl, row->rsize);
+static int syntaxHighlight(erow *row, int from, int state, int resync);
+
+/*
+ * Highlight a row starting from the syntax state left by the row above,
+ * returns the state left for the row below
+ */
+int editorUpdateSyntax(erow *row, int state){
+    // hl shares its block size with render so both can grow together
+    if(row->hl == NULL){
+        row->hl = editorRowAlloc(row->render_cap, NULL);
+    }
     memset(row->hl, HL_NORMAL, row->rsize);
+    row->hl_state = state;
 
-    if(CONFIG.syntax == NULL){
-        return;
+    if(CONFIG.syntax == NULL || state == HL_STATE_NONE){
+        return 0;
     }
+    return syntaxHighlight(row, 0, state, row->rsize);
+}
 
-    char** keywords = CONFIG.syntax->keywords;
+/*
+ * The lexer of editorUpdateSyntax, colouring render from `from` on. Past
+ * position 0 the lexer has to be starting right after a plain separator,
+ * where it is in the normal state. Once at or past `resync` it stops on the
+ * first plain separator the old hl also had as one, as from there on the
+ * old colours still hold, and returns -1 rather than the end state.
+ */
+static int syntaxHighlight(erow *row, int from, int state, int resync){
+    int kw_maxlen = CONFIG.syntax->kw_maxlen;
 
     char* scs = CONFIG.syntax->singleline_comment_start;
+    char* mcs = CONFIG.syntax->multiline_comment_start;
+    char* mce = CONFIG.syntax->multiline_comment_end;
     int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
     
     int prev_sep = 1;
-    int in_string = 0;
+    int in_string = (state != HL_STATE_COMMENT) ? state : 0;
+    int in_comment = (state == HL_STATE_COMMENT);
+    int continued = 0;
     
-    int i = 0;
+    int i = from;
     
     while(i < row->rsize){
         char character = row->render[i];
         unsigned char prev_hl = (i > 0 ) ? row->hl[i - 1] : HL_NORMAL;
 
-        if(scs_len && !in_string){
-            if(!strncmp(&row->render[i], scs, scs_len)){
+        if(scs_len && !in_string && !in_comment){
+            if(character == scs[0] && !strncmp(&row->render[i], scs, scs_len)){
                 memset(&row->hl[i], HL_COMMENT, row->rsize - i);
                 break;
             }
         }
+
+        if(mcs_len && mce_len && !in_string){
+            if(in_comment){
+                row->hl[i] = HL_MLCOMMENT;
+                if(character == mce[0] && !strncmp(&row->render[i], mce, mce_len)){
+                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                } else {
+                    i++;
+                }
+                continue;
+            } else if(character == mcs[0] && !strncmp(&row->render[i], mcs, mcs_len)){
+                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
         
         if(CONFIG.syntax->flags & HL_HIGHLIGHT_STRINGS){
             if(in_string){
                 row->hl[i] = HL_STRING;
-                if(character =='\\' && i + 1 < row->rsize){
-                    row->hl[i+1] = HL_STRING;
-                    i += 2;
-                    continue;
+                if(character =='\\'){
+                    if(i + 1 < row->rsize){
+                        row->hl[i+1] = HL_STRING;
+                        i += 2;
+                        continue;
+                    }
+                    continued = 1;
                 }
                 if(character == in_string) {
                     in_string = 0;
@@ -516,622 +670,4437 @@ void editorUpdateSyntax(erow *row){
         }
 
         if (prev_sep) {
-            int j;
-            for(j = 0; keywords[j]; j++){
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen-1] == '|';
-                if(kw2) {
-                    klen --;
-                }
-
-                if(!strncmp(&row->render[i], keywords[j], klen) &&
-                   is_seperator(row->render[i + klen])) {
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
+            // A keyword is a whole token, so find where this one ends and
+            // look it up once
+            int klen = 0;
+            while(klen <= kw_maxlen && i + klen < row->rsize &&
+                  !SEPARATORS[(unsigned char) row->render[i + klen]]){
+                klen++;
             }
-            if (keywords[j] != NULL){
+            int kw = (klen > 0 && klen <= kw_maxlen) ?
+                editorKeywordLookup(CONFIG.syntax, &row->render[i], klen) : HL_NORMAL;
+            if(kw != HL_NORMAL){
+                memset(&row->hl[i], kw, klen);
+                i += klen;
                 prev_sep = 0;
                 continue;
             }
         }
 
-        prev_sep = is_seperator(character);
+        prev_sep = SEPARATORS[(unsigned char) character];
+        if(prev_sep && i >= resync && row->hl[i] == HL_NORMAL){
+            return -1;
+        }
+        row->hl[i] = HL_NORMAL;
         i++;
     }
-}
-
-int is_seperator(int c){
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
-}
 
-void editorSelectSyntaxHighlight(){
-    CONFIG.syntax = NULL;
-    if(CONFIG.filename == NULL){
-        return;
+    if(in_comment){
+        return HL_STATE_COMMENT;
     }
+    // Only a trailing backslash carries a string over to the next line
+    return continued ? in_string : 0;
+}
 
-    char* ext  = strrchr(CONFIG.filename, '.');
+static int syntaxMatch(const char *s, int len, int i, const char *token, int token_len){
+    return i + token_len <= len && !memcmp(&s[i], token, token_len);
+}
 
-    for(unsigned int j = 0; j < HLDB_ENTRIES; j++){
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while(s->filematch[i]){
-            int is_ext = (s->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(CONFIG.filename, s->filematch[i]))) {
-                CONFIG.syntax = s;
+/*
+ * The state part of editorUpdateSyntax, run on raw text without building hl.
+ * It has to agree with editorUpdateSyntax on the state it returns.
+ */
+static int syntaxScan(const char *s, int len, int state){
+    char* scs = CONFIG.syntax->singleline_comment_start;
+    char* mcs = CONFIG.syntax->multiline_comment_start;
+    char* mce = CONFIG.syntax->multiline_comment_end;
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+    int strings = CONFIG.syntax->flags & HL_HIGHLIGHT_STRINGS;
+    int continued = 0;
 
-                int filerow;
-                for(filerow = 0; filerow < CONFIG.numrows; filerow++){
-                    editorUpdateSyntax(&CONFIG.row[filerow]);
+    int i = 0;
+    while(i < len){
+        if(state == HL_STATE_COMMENT){
+            if(syntaxMatch(s, len, i, mce, mce_len)){
+                i += mce_len;
+                state = 0;
+            } else {
+                i++;
+            }
+        } else if(state){
+            if(s[i] == '\\'){
+                if(i + 1 < len){
+                    i += 2;
+                    continue;
                 }
-                
-                return;
+                continued = 1;
+            }
+            if(s[i] == state){
+                state = 0;
             }
             i++;
+        } else if(scs_len && syntaxMatch(s, len, i, scs, scs_len)){
+            return 0;
+        } else if(mcs_len && mce_len && syntaxMatch(s, len, i, mcs, mcs_len)){
+            i += mcs_len;
+            state = HL_STATE_COMMENT;
+        } else if(strings && (s[i] == '"' || s[i] == '\'')){
+            state = s[i];
+            i++;
+        } else {
+            i++;
         }
     }
-}
-
-/*** row operations ***/
-void editorUpdateRow(erow *row){
-    int tabs = 0;
-    int j;
 
-    for(j=0; j < row->size; j++){
-        if(row->chars[j] == '\t'){
-           tabs++;
-        }
+    if(state == HL_STATE_COMMENT || continued){
+        return state;
     }
+    return 0;
+}
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(KILO_TAB_STOP -1) + 1);
+/*
+ * Whether the current syntax has any state that crosses line boundaries
+ */
+int editorSyntaxTracked(){
+    return CONFIG.syntax &&
+        ((CONFIG.syntax->multiline_comment_start && CONFIG.syntax->multiline_comment_end) ||
+         (CONFIG.syntax->flags & HL_HIGHLIGHT_STRINGS));
+}
 
-    int idx = 0;
+// State before `line` as found by the lexer thread, -1 if it is not there yet
+static int lexerState(int line){
+    if(line >= __atomic_load_n(&LEXER.lines_done, __ATOMIC_ACQUIRE)) return -1;
+    return LEXER.blocks[line / LEXER_BLOCK_LINES][line % LEXER_BLOCK_LINES];
+}
 
-    for(j=0; j< row->size; j++){
-        if(row->chars[j] == '\t'){
-            while(idx % KILO_TAB_STOP != 0){
-                row -> render[idx++] = ' ';
+/*
+ * Make room for the checkpoints of a span, one per multiple of
+ * SYNTAX_CHECKPOINT_LINES it holds, indexed from the one at or before its
+ * first line. Spans that hold none get no room.
+ */
+static void syntaxCheckpoints(rownode *node){
+    int first = node->first_line / SYNTAX_CHECKPOINT_LINES;
+    int last = (node->first_line + node->nlines - 1) / SYNTAX_CHECKPOINT_LINES;
+    int n = last > first ? last - first + 1 : 0;
+    if(n == node->nstates) return;
+    editorRowFree(node->states, node->nstates);
+    node->states = n ? editorRowAlloc(n, NULL) : NULL;
+    node->nstates = n;
+}
+
+/*
+ * State after the lines [line, end) of the file buffer, starting in `state`.
+ * Wherever the lexer thread went through a line in the same state, its
+ * states for the lines after that hold as well and are used instead. The
+ * checkpoints of `span` on the way are filled in when it has any.
+ */
+static int syntaxScanLines(int line, int end, int state, rownode *span){
+    int known = __atomic_load_n(&LEXER.lines_done, __ATOMIC_ACQUIRE);
+    int base = span && span->states ? span->first_line / SYNTAX_CHECKPOINT_LINES : -1;
+    while(line < end){
+        if(base != -1 && line % SYNTAX_CHECKPOINT_LINES == 0){
+            span->states[line / SYNTAX_CHECKPOINT_LINES - base] = state;
+        }
+        if(line < known && lexerState(line) == state){
+            int to = end < known - 1 ? end : known - 1;
+            if(to > line){
+                int at;
+                for(at = (line / SYNTAX_CHECKPOINT_LINES + 1) * SYNTAX_CHECKPOINT_LINES;
+                    base != -1 && at < to; at += SYNTAX_CHECKPOINT_LINES){
+                    span->states[at / SYNTAX_CHECKPOINT_LINES - base] = lexerState(at);
+                }
+                state = lexerState(to);
+                line = to;
+                continue;
             }
+        }
+        state = syntaxScan(&CONFIG.filebuf[CONFIG.line_start[line]], editorLineLength(line), state);
+        line++;
+    }
+    return state;
+}
 
-        } else {
-            row->render[idx++] = row->chars[j];
+/*
+ * Recompute the states of a node starting from `state`. Rows whose cached
+ * colours were built from a different state lose their cache.
+ */
+static void syntaxRelex(rownode *node, int state){
+    node->state_in = state;
+    if(node->first_line == -1){
+        erow *row = &node->row;
+        if(row->render && row->hl_state != state){
+            editorRowInvalidate(row);
         }
+        if(row == CONFIG.gap_row){
+            editorRowGapClose();
+        }
+        state = syntaxScan(row->chars, row->size, state);
+    } else {
+        syntaxCheckpoints(node);
+        state = syntaxScanLines(node->first_line, node->first_line + node->nlines, state, node);
     }
+    node->state_out = state;
+    node->state_valid = 1;
+}
 
-    row->render[idx] = '\0';
-    row->rsize = idx;
+/*
+ * Extend the known syntax states over the first `rows` rows. States are
+ * only ever known for a prefix of the file, because each line depends on
+ * every line above it.
+ */
+static void syntaxExtend(int rows, size_t budget){
+    if(!editorSyntaxTracked()) return;
+    if(rows > CONFIG.numrows){
+        rows = CONFIG.numrows;
+    }
+    if(CONFIG.syntax_valid >= rows) return;
+
+    int offset;
+    rownode *node = editorRowNodeAt(CONFIG.syntax_valid, &offset);
+    rownode *prev = editorRowNodePrev(node);
+    int state = prev ? prev->state_out : 0;
+
+    while(node && CONFIG.syntax_valid < rows){
+        int end = node->first_line + node->nlines;
+        if(node->first_line != -1 && lexerState(end) == -1){
+            // The lexer thread has not been through this span yet
+            size_t bytes = CONFIG.line_start[end] - CONFIG.line_start[node->first_line];
+            if(bytes > budget) break;
+            budget -= bytes;
+        }
+        syntaxRelex(node, state);
+        state = node->state_out;
+        CONFIG.syntax_valid += node->nlines;
+        node = editorRowNodeNext(node);
+    }
+}
 
-    editorUpdateSyntax(row);
+void editorSyntaxUpTo(int rows){
+    syntaxExtend(rows, (size_t) -1);
 }
 
-void editorInsertRow(int at, char* s, size_t len){
-    if(at < 0 || at > CONFIG.numrows) return;
+/*
+ * Extend the known states towards `rows` rows as far as can be done without
+ * a long scan. Spans the lexer thread has not reached are only lexed here
+ * up to KILO_SYNTAX_BUDGET bytes, rows past that are drawn plain until the
+ * thread catches up.
+ */
+void editorSyntaxAvailable(int rows){
+    syntaxExtend(rows, KILO_SYNTAX_BUDGET);
+}
 
-    CONFIG.row = realloc(CONFIG.row, sizeof(erow) * (CONFIG.numrows + 1));
-    memmove(&CONFIG.row[at + 1], &CONFIG.row[at], sizeof(erow) * (CONFIG.numrows - at));
+/*
+ * Whether rows on screen are still waiting for their syntax state
+ */
+int editorSyntaxPending(){
+    int rows = CONFIG.rowoff + CONFIG.screenrows;
+    if(rows > CONFIG.numrows){
+        rows = CONFIG.numrows;
+    }
+    return editorSyntaxTracked() && CONFIG.syntax_valid < rows;
+}
 
-    CONFIG.row[at].size = len;
-    CONFIG.row[at].chars = malloc(len + 1);
-    memcpy(CONFIG.row[at].chars, s, len);
-    CONFIG.row[at].chars[len] = '\0';
+/*
+ * Row `at` changed, or a row was inserted or deleted just before it.
+ * Re-lex forward only until a line starts in the same state as before,
+ * everything below that is still right.
+ */
+void editorSyntaxUpdate(int at){
+    if(!editorSyntaxTracked() || at >= CONFIG.syntax_valid) return;
+
+    int offset;
+    rownode *node = editorRowNodeAt(at, &offset);
+    rownode *prev = editorRowNodePrev(node);
+    int state = prev ? prev->state_out : 0;
+
+    syntaxRelex(node, state);
+    state = node->state_out;
+    for(node = editorRowNodeNext(node); node && node->state_valid && node->state_in != state;
+        node = editorRowNodeNext(node)){
+        syntaxRelex(node, state);
+        state = node->state_out;
+    }
+}
 
-    CONFIG.row[at].rsize = 0;
-    CONFIG.row[at].render = NULL;
-    CONFIG.row[at].hl = NULL;
-    editorUpdateRow(&CONFIG.row[at]);
+static void syntaxResetNode(rownode *node){
+    if(node == NULL) return;
+    syntaxResetNode(node->left);
+    node->state_valid = 0;
+    node->state_in = node->state_out = 0;
+    syntaxResetNode(node->right);
+}
 
-    CONFIG.numrows++;
-    CONFIG.dirty++;
+/*
+ * Forget every syntax state, after the syntax itself changed
+ */
+void editorSyntaxReset(){
+    syntaxResetNode(CONFIG.rows);
+    CONFIG.syntax_valid = 0;
 }
-void editorFreeRow(erow *row){
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+
+// Set the state before `line`, allocating its block on first use
+static void lexerSet(int line, int state){
+    unsigned char **block = &LEXER.blocks[line / LEXER_BLOCK_LINES];
+    if(*block == NULL){
+        *block = malloc(LEXER_BLOCK_LINES);
+        if(*block == NULL){
+            die("malloc");
+        }
+    }
+    (*block)[line % LEXER_BLOCK_LINES] = state;
 }
 
-void editorDelRow(int at){
-    if( at < 0 || at >= CONFIG.numrows) return;
-    editorFreeRow(&CONFIG.row[at]);
-    memmove(&CONFIG.row[at], &CONFIG.row[at + 1], sizeof(erow) * (CONFIG.numrows - at -1));
-    CONFIG.numrows--;
-    CONFIG.dirty++;
+static void *lexerMain(void *arg){
+    (void) arg;
+    size_t pos = 0;
+    size_t notified = 0;
+    int line = 0;
+    int state = 0;
+
+    lexerSet(0, 0);
+    __atomic_store_n(&LEXER.lines_done, 1, __ATOMIC_RELEASE);
+    while(pos < LEXER.len && !__atomic_load_n(&LEXER.stop, __ATOMIC_RELAXED)){
+        // Lines are cut the way editorRowsIndexMore() cuts them
+        const char *nl = memchr(&LEXER.buf[pos], '\n', LEXER.len - pos);
+        size_t end = nl ? (size_t) (nl - LEXER.buf) : LEXER.len;
+        size_t len = end - pos;
+        while(len > 0 && LEXER.buf[pos + len - 1] == '\r'){
+            len--;
+        }
+        state = syntaxScan(&LEXER.buf[pos], len, state);
+        pos = end + 1;
+        line++;
+        lexerSet(line, state);
+        __atomic_store_n(&LEXER.lines_done, line + 1, __ATOMIC_RELEASE);
+
+        if(pos - notified >= KILO_INDEX_CHUNK || pos >= LEXER.len){
+            write(CONFIG.signal_pipe[1], "h", 1);
+            notified = pos;
+        }
+    }
+    return NULL;
 }
-void editorRowInsertChar(erow * row, int at, int input){
-    if(at < 0 || at > row->size){
-        at = row->size;
+
+/*
+ * Start lexing the file buffer in the background, for syntaxes that carry
+ * state across lines
+ */
+void editorLexerStart(){
+    editorLexerStop();
+    if(!editorSyntaxTracked() || CONFIG.filebuf == NULL) return;
+
+    LEXER.buf = CONFIG.filebuf;
+    LEXER.len = CONFIG.filesize;
+    // A line takes at least one byte, plus the state after the last line
+    LEXER.nblocks = (CONFIG.filesize + 1) / LEXER_BLOCK_LINES + 1;
+    LEXER.blocks = calloc(LEXER.nblocks, sizeof(unsigned char *));
+    if(LEXER.blocks == NULL){
+        die("calloc");
     }
+    LEXER.stop = 0;
+    if(pthread_create(&LEXER.thread, NULL, lexerMain, NULL) != 0){
+        die("pthread_create");
+    }
+    LEXER.running = 1;
+}
 
-    row->chars = realloc(row->chars, row->size + 2); //reallocate enough space for new char and nullbyte
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = input;
-    editorUpdateRow(row);
-    CONFIG.dirty++;
+/*
+ * Stop the lexer thread and drop its states. Must come before the file
+ * buffer or the syntax changes.
+ */
+void editorLexerStop(){
+    if(!LEXER.running) return;
+    __atomic_store_n(&LEXER.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(LEXER.thread, NULL);
+    LEXER.running = 0;
+    LEXER.lines_done = 0;
+
+    int i;
+    for(i = 0; i < LEXER.nblocks; i++){
+        free(LEXER.blocks[i]);
+    }
+    free(LEXER.blocks);
+    LEXER.blocks = NULL;
+    LEXER.nblocks = 0;
 }
 
-void editorRowDelChar(erow *row, int at){
-    if(at < 0 || at >=row->size) return;
+int is_seperator(int c){
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
 
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    CONFIG.dirty++;
+static unsigned int keywordHash(const char *s, int len){
+    // FNV-1a, keywords are short so hashing the whole token is cheap
+    unsigned int hash = 2166136261u;
+    int i;
+    for(i = 0; i < len; i++){
+        hash = (hash ^ (unsigned char) s[i]) * 16777619u;
+    }
+    return hash;
 }
 
-int editorRowCxToRx(erow *row, int cx){
-    int rx = 0;
-    int j;
-    for(j=0; j < cx; j++){
-        if(row->chars[j] == '\t'){
-           rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+/*
+ * Build the keyword hash table of a syntax. The table is kept at most a
+ * quarter full so a lookup is nearly always a single probe, and the "|"
+ * suffix marking type keywords is decoded here instead of on every token.
+ */
+void editorSyntaxCompile(struct editorSyntax *syntax){
+    int i;
+
+    if(!SEPARATORS['\0']){
+        for(i = 0; i < 256; i++){
+            SEPARATORS[i] = is_seperator(i);
         }
-        rx++;
     }
-    return rx;
-}
+    if(syntax->kw_table) return;
 
-int editorRowRxToCx(erow *row, int rx){
-    int cur_rx = 0;
-    int cx;
+    unsigned int count = 0;
+    while(syntax->keywords[count]) count++;
 
-    for(cx = 0; cx < row->size; cx++){
-        if(row->chars[cx] == '\t'){
-            cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
+    unsigned int size = 4;
+    while(size < count * 4) size *= 2;
+
+    syntax->kw_table = calloc(size, sizeof(struct editorKeyword));
+    syntax->kw_mask = size - 1;
+    syntax->kw_maxlen = 0;
+
+    for(i = 0; syntax->keywords[i]; i++){
+        const char *word = syntax->keywords[i];
+        int len = strlen(word);
+        unsigned char hl = HL_KEYWORD1;
+        if(len > 0 && word[len - 1] == '|'){
+            len--;
+            hl = HL_KEYWORD2;
         }
-        cur_rx++;
+        if(len == 0 || editorKeywordLookup(syntax, word, len) != HL_NORMAL) continue;
 
-        if(cur_rx > rx){
-            return cx;
+        unsigned int slot = keywordHash(word, len) & syntax->kw_mask;
+        while(syntax->kw_table[slot].word){
+            slot = (slot + 1) & syntax->kw_mask;
+        }
+        syntax->kw_table[slot].word = word;
+        syntax->kw_table[slot].len = len;
+        syntax->kw_table[slot].hl = hl;
+        if(len > syntax->kw_maxlen){
+            syntax->kw_maxlen = len;
         }
     }
-    return cx;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len){
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    CONFIG.dirty++;
+/*
+ * Highlight class of a token, HL_NORMAL if it isn't a keyword
+ */
+int editorKeywordLookup(struct editorSyntax *syntax, const char *s, int len){
+    unsigned int slot = keywordHash(s, len) & syntax->kw_mask;
+    while(syntax->kw_table[slot].word){
+        struct editorKeyword *kw = &syntax->kw_table[slot];
+        if(kw->len == len && !memcmp(kw->word, s, len)){
+            return kw->hl;
+        }
+        slot = (slot + 1) & syntax->kw_mask;
+    }
+    return HL_NORMAL;
 }
 
-/*** editor operations **/
-void editorInsertChar(int input){
-    if(CONFIG.cy == CONFIG.numrows){
-        editorInsertRow(CONFIG.numrows,"", 0);
+void editorSelectSyntaxHighlight(){
+    editorLexerStop();
+    CONFIG.syntax = NULL;
+    // Highlighting is redone as rows are drawn again
+    editorSyntaxReset();
+    editorRowsForEach(editorRowInvalidate);
+    if(CONFIG.filename == NULL){
+        return;
+    }
+
+    char* ext  = strrchr(CONFIG.filename, '.');
+
+    for(unsigned int j = 0; j < HLDB_ENTRIES; j++){
+        struct editorSyntax *s = &HLDB[j];
+        unsigned int i = 0;
+        while(s->filematch[i]){
+            int is_ext = (s->filematch[i][0] == '.');
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+                (!is_ext && strstr(CONFIG.filename, s->filematch[i]))) {
+                editorSyntaxCompile(s);
+                CONFIG.syntax = s;
+                editorLexerStart();
+                return;
+            }
+            i++;
+        }
     }
-    editorRowInsertChar(&CONFIG.row[CONFIG.cy], CONFIG.cx, input);
-    CONFIG.cx++;
 }
 
-void editorInsertNewline() {
-  if (CONFIG.cx == 0) {
-    editorInsertRow(CONFIG.cy, "", 0);
-  } else {
-    erow *row = &CONFIG.row[CONFIG.cy];
+/*** row memory ***/
+static int rowMemClass(size_t size){
+    if(size <= 256){
+        return size ? (size - 1) >> 4 : 0;
+    }
+    int shift = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(size - 1);
+    int quarter = ((size - 1) >> (shift - 2)) & 3;
+    return 16 + (shift - 8) * 4 + quarter;
+}
 
-    editorInsertRow(CONFIG.cy + 1, &row->chars[CONFIG.cx], row->size - CONFIG.cx);
-    row = &CONFIG.row[CONFIG.cy];
-    row->size = CONFIG.cx;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-  }
-  CONFIG.cy++;
-  CONFIG.cx = 0;
+static size_t rowMemClassSize(int cls){
+    if(cls < 16){
+        return (size_t)(cls + 1) << 4;
+    }
+    int shift = (cls - 16) / 4 + 8;
+    return (size_t)(5 + (cls - 16) % 4) << (shift - 2);
 }
 
-void editorDelChar(){
-    // if the cursor is past the end of the file there is nothing to delete
-    if(CONFIG.cy == CONFIG.numrows) return;
-    if(CONFIG.cx == 0 && CONFIG.cy == 0) return;
+// Cut a new slab into blocks and put them on the free list of a class
+static void rowMemRefill(int cls){
+    size_t block_size = rowMemClassSize(cls);
+    char *slab = malloc(ROWMEM_SLAB);
+    if(slab == NULL){
+        die("malloc");
+    }
+    CONFIG.mem_reserved += ROWMEM_SLAB;
 
-    erow *row = &CONFIG.row[CONFIG.cy];
-    if(CONFIG.cx > 0){
-        editorRowDelChar(row, CONFIG.cx - 1);
-        CONFIG.cx--;
-    } else {
-        CONFIG.cx = CONFIG.row[CONFIG.cy - 1].size;
-        editorRowAppendString(&CONFIG.row[CONFIG.cy -1], row->chars, row->size);
-        editorDelRow(CONFIG.cy);
-        CONFIG.cy--;
+    size_t offset;
+    for(offset = ROWMEM_SLAB; offset >= block_size; offset -= block_size){
+        void *block = slab + offset - block_size;
+        *(void **)block = CONFIG.mem_free[cls];
+        CONFIG.mem_free[cls] = block;
     }
 }
 
-/*** file i/o ***/
+/*
+ * Allocate row memory for at least size bytes. The block is rounded up to
+ * its size class and the usable size is stored in cap when it is not NULL.
+ */
+void *editorRowAlloc(size_t size, int *cap){
+    int cls = rowMemClass(size);
+    if(cls >= ROWMEM_CLASSES){
+        void *block = malloc(size);
+        if(block == NULL){
+            die("malloc");
+        }
+        CONFIG.mem_reserved += size;
+        CONFIG.mem_used += size;
+        if(cap) *cap = size;
+        return block;
+    }
+
+    if(CONFIG.mem_free[cls] == NULL){
+        rowMemRefill(cls);
+    }
+    void *block = CONFIG.mem_free[cls];
+    CONFIG.mem_free[cls] = *(void **)block;
+
+    size_t block_size = rowMemClassSize(cls);
+    CONFIG.mem_used += block_size;
+    if(cap) *cap = block_size;
+    return block;
+}
 
 /*
- * Convert a buffer to a single string
+ * Make a block hold at least size bytes, keeping its contents. Big blocks
+ * grow by half again so appending to a long row doesn't copy every time.
  */
-char* editorRowsToString(int *buflen){
-    int totlen=0;
-    int j;
-    for(j=0; j<CONFIG.numrows; j++){
-        totlen += CONFIG.row[j].size + 1;
+void *editorRowGrow(void *block, int *cap, size_t size){
+    if(size <= (size_t) *cap){
+        return block;
+    }
+    size_t want = (size_t) *cap + *cap / 2;
+    if(want < size){
+        want = size;
     }
-    *buflen = totlen;
 
-    char *buf = malloc(totlen);
-    char *p = buf;
+    int new_cap;
+    void *new = editorRowAlloc(want, &new_cap);
+    memcpy(new, block, *cap);
+    editorRowFree(block, *cap);
+    *cap = new_cap;
+    return new;
+}
 
-    for(j=0; j < CONFIG.numrows; j++){
-        memcpy(p, CONFIG.row[j].chars, CONFIG.row[j].size);
-        p += CONFIG.row[j].size;
-        *p = '\n';
-        p++;
+/*
+ * Give a block back. size is either the size it was asked for with or the
+ * cap it was given, both map to the same class.
+ */
+void editorRowFree(void *block, size_t size){
+    if(block == NULL) return;
+
+    int cls = rowMemClass(size);
+    if(cls >= ROWMEM_CLASSES){
+        free(block);
+        CONFIG.mem_reserved -= size;
+        CONFIG.mem_used -= size;
+        return;
     }
-    return buf;
+    *(void **)block = CONFIG.mem_free[cls];
+    CONFIG.mem_free[cls] = block;
+    CONFIG.mem_used -= rowMemClassSize(cls);
 }
 
-void editorOpen(char* filename){
-    free(CONFIG.filename);
-    CONFIG.filename = strdup(filename);
+/*** row storage ***/
+static unsigned int rowPriority(){
+    // xorshift, the treap only needs priorities to be well spread
+    static unsigned int state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
 
-    editorSelectSyntaxHighlight();
-    
-    FILE *fp = fopen(filename, "r");
+static int rowCount(rownode *node){
+    return node ? node->count : 0;
+}
+
+static size_t rowBytes(rownode *node){
+    return node ? node->bytes : 0;
+}
+
+// Offset of a line of the original file in the text, where every line ends
+// in a single newline
+static size_t lineOffset(int line){
+    return CONFIG.line_start[line] - (CONFIG.line_cr ? CONFIG.line_cr[line] : 0);
+}
+
+// Bytes of text held by the node itself
+static size_t rowNodeBytes(rownode *node){
+    if(node->first_line == -1){
+        return node->row.size + 1;
+    }
+    return lineOffset(node->first_line + node->nlines) - lineOffset(node->first_line);
+}
+
+static void rowNodeUpdate(rownode *node){
+    node->count = rowCount(node->left) + node->nlines + rowCount(node->right);
+    node->bytes = rowBytes(node->left) + rowNodeBytes(node) + rowBytes(node->right);
+    if(node->left) node->left->parent = node;
+    if(node->right) node->right->parent = node;
+}
+
+static void rowTreeSetRoot(rownode *root){
+    CONFIG.rows = root;
+    if(root) root->parent = NULL;
+}
+
+static rownode *rowNodeNew(int first_line, int nlines){
+    rownode *node = editorRowAlloc(sizeof(rownode), NULL);
+    memset(node, 0, sizeof(rownode));
+    node->priority = rowPriority();
+    node->first_line = first_line;
+    node->nlines = nlines;
+    rowNodeUpdate(node);
+    return node;
+}
+
+// A row changed size, fix the byte counts up to the root: O(log n)
+static void rowTreeResized(erow *row){
+    rownode *node = (rownode *) ((char *) row - offsetof(rownode, row));
+    for(; node; node = node->parent){
+        node->bytes = rowBytes(node->left) + rowNodeBytes(node) + rowBytes(node->right);
+    }
+}
+
+static void rowNodeFree(rownode *node){
+    if(node->first_line == -1){
+        editorFreeRow(&node->row);
+    }
+    editorRowFree(node->states, node->nstates);
+    editorRowFree(node, sizeof(rownode));
+}
+
+static rownode *rowTreeMerge(rownode *a, rownode *b){
+    if(a == NULL) return b;
+    if(b == NULL) return a;
+
+    if(a->priority > b->priority){
+        a->right = rowTreeMerge(a->right, b);
+        rowNodeUpdate(a);
+        return a;
+    }
+    b->left = rowTreeMerge(a, b->left);
+    rowNodeUpdate(b);
+    return b;
+}
 
-    if(!fp){
-        die("fopen");
+// Split a tree so that the first k rows end up in *a and the rest in *b.
+// A span straddling the split point is cut in two.
+static void rowTreeSplit(rownode *node, int k, rownode **a, rownode **b){
+    if(node == NULL){
+        *a = *b = NULL;
+        return;
     }
 
-    char* line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen; // Why ssize_t?
-    while((linelen = getline(&line, &linecap, fp)) != -1) {//Draw as many rows as possible
-        while(linelen > 0 && (line[linelen - 1] == '\n' ||
-                              line[linelen - 1] == '\r')){
-            linelen--;
+    int left = rowCount(node->left);
+    if(k <= left){
+        rowTreeSplit(node->left, k, a, &node->left);
+        rowNodeUpdate(node);
+        *b = node;
+    } else if(k >= left + node->nlines){
+        rowTreeSplit(node->right, k - left - node->nlines, &node->right, b);
+        rowNodeUpdate(node);
+        *a = node;
+    } else {
+        int cut = k - left;
+        rownode *rest = rowNodeNew(node->first_line + cut, node->nlines - cut);
+        if(node->state_valid){
+            // Find the syntax state at the cut from the checkpoint before
+            // it, both halves stay known
+            int line = node->first_line;
+            int state = node->state_in;
+            int base = line / SYNTAX_CHECKPOINT_LINES;
+            int at = rest->first_line / SYNTAX_CHECKPOINT_LINES;
+            if(node->states && at > base){
+                line = at * SYNTAX_CHECKPOINT_LINES;
+                state = node->states[at - base];
+            }
+            state = syntaxScanLines(line, rest->first_line, state, NULL);
+            rest->state_in = state;
+            rest->state_out = node->state_out;
+            rest->state_valid = 1;
+            node->state_out = state;
+            // The checkpoints past the cut go with the rest
+            syntaxCheckpoints(rest);
+            if(rest->states){
+                memcpy(rest->states, &node->states[at - base], rest->nstates);
+            }
         }
-        editorInsertRow(CONFIG.numrows, line, linelen);
+        node->nlines = cut;
+        *b = rowTreeMerge(rest, node->right);
+        node->right = NULL;
+        rowNodeUpdate(node);
+        *a = node;
     }
+}
 
-    free(line);
-    fclose(fp);
-    CONFIG.dirty = 0;
+static void rowTreeFree(rownode *node){
+    if(node == NULL) return;
+    rowTreeFree(node->left);
+    rowTreeFree(node->right);
+    rowNodeFree(node);
 }
 
-void editorSave(){
-    if(CONFIG.filename == NULL){
-        CONFIG.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if(CONFIG.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
-            return;
+// Length of a line of the original file, without its line terminator
+int editorLineLength(int line){
+    size_t start = CONFIG.line_start[line];
+    size_t len = CONFIG.line_start[line + 1] - start - 1;
+    while(len > 0 && CONFIG.filebuf[start + len - 1] == '\r'){
+        len--;
+    }
+    return len;
+}
+
+// Turn a single line span into a row that owns a copy of its text
+static void rowMaterialize(rownode *node){
+    int line = node->first_line;
+    int len = editorLineLength(line);
+    erow *row = &node->row;
+
+    row->size = len;
+    row->chars = editorRowAlloc(len + 1, &row->cap);
+    memcpy(row->chars, &CONFIG.filebuf[CONFIG.line_start[line]], len);
+    row->chars[len] = '\0';
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    node->first_line = -1;
+    editorRowFree(node->states, node->nstates);
+    node->states = NULL;
+    node->nstates = 0;
+}
+
+/*
+ * Node holding row `at`, and the position of the row within it
+ */
+rownode *editorRowNodeAt(int at, int *offset){
+    if(at < 0 || at >= CONFIG.numrows) return NULL;
+
+    rownode *node = CONFIG.rows;
+    while(1){
+        int left = rowCount(node->left);
+        if(at < left){
+            node = node->left;
+        } else if(at >= left + node->nlines){
+            at -= left + node->nlines;
+            node = node->right;
+        } else {
+            *offset = at - left;
+            return node;
         }
-        editorSelectSyntaxHighlight();
     }
+}
+
+rownode *editorRowNodeNext(rownode *node){
+    if(node->right){
+        node = node->right;
+        while(node->left) node = node->left;
+        return node;
+    }
+    while(node->parent && node->parent->right == node){
+        node = node->parent;
+    }
+    return node->parent;
+}
 
-    int len;
-    char *buf = editorRowsToString(&len);
+rownode *editorRowNodePrev(rownode *node){
+    if(node->left){
+        node = node->left;
+        while(node->right) node = node->right;
+        return node;
+    }
+    while(node->parent && node->parent->left == node){
+        node = node->parent;
+    }
+    return node->parent;
+}
 
+/*
+ * Row number of a materialized row, O(log n)
+ */
+int editorRowIndex(erow *row){
+    rownode *node = (rownode *) ((char *) row - offsetof(rownode, row));
+    int at = rowCount(node->left);
+    while(node->parent){
+        if(node->parent->right == node){
+            at += rowCount(node->parent->left) + node->parent->nlines;
+        }
+        node = node->parent;
+    }
+    return at;
+}
 
-    int fd = open(CONFIG.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1){
-        if (ftruncate(fd, len) != -1){
-            if (write(fd, buf, len) == len){
-                close(fd);
-                free(buf);
-                CONFIG.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
+/*
+ * Offset of the start of row `at` in the text, O(log n). Rows end in one
+ * newline, as they are saved.
+ */
+size_t editorRowOffset(int at){
+    size_t offset = 0;
+    rownode *node = CONFIG.rows;
+    while(node){
+        int left = rowCount(node->left);
+        if(at < left){
+            node = node->left;
+        } else if(at < left + node->nlines){
+            offset += rowBytes(node->left);
+            if(node->first_line != -1){
+                int line = node->first_line + at - left;
+                offset += lineOffset(line) - lineOffset(node->first_line);
             }
+            return offset;
+        } else {
+            at -= left + node->nlines;
+            offset += rowBytes(node->left) + rowNodeBytes(node);
+            node = node->right;
         }
-        close(fd);
     }
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O errors: %s", strerror(errno));
+    return offset;
 }
 
-/*** append buffer ***/
-// appendbuffer append
-void abAppend(struct abuf *ab, const char* string, int len) {
-    // ab = append buffer to add string to
-    // string = string to copy
-    // len = length
+/*
+ * Row holding the byte at `offset` in the text, and the column of that byte
+ * in it, O(log n). Past the end is the row after the last.
+ */
+int editorRowAtOffset(size_t offset, size_t *col){
+    int at = 0;
+    rownode *node = CONFIG.rows;
+    *col = 0;
+    if(offset >= rowBytes(node)) return CONFIG.numrows;
 
-    // increase the size of our append buffer to be the length of ab + new string length
-    char *new = realloc(ab->buf, ab->len + len);
+    while(1){
+        size_t left = rowBytes(node->left);
+        size_t own = rowNodeBytes(node);
+        if(offset < left){
+            node = node->left;
+        } else if(offset < left + own){
+            offset -= left;
+            at += rowCount(node->left);
+            if(node->first_line != -1){
+                // Last line of the span starting at or before offset
+                size_t base = lineOffset(node->first_line);
+                int lo = node->first_line;
+                int hi = node->first_line + node->nlines - 1;
+                while(lo < hi){
+                    int mid = lo + (hi - lo + 1) / 2;
+                    if(lineOffset(mid) - base <= offset){
+                        lo = mid;
+                    } else {
+                        hi = mid - 1;
+                    }
+                }
+                at += lo - node->first_line;
+                offset -= lineOffset(lo) - base;
+            }
+            *col = offset;
+            return at;
+        } else {
+            offset -= left + own;
+            at += rowCount(node->left) + node->nlines;
+            node = node->right;
+        }
+    }
+}
 
-    // error out
-    if (new == NULL) return;
+erow *editorRowAt(int at){
+    int offset;
+    rownode *node = editorRowNodeAt(at, &offset);
+    if(node == NULL) return NULL;
 
-    // copy string into new buffer starting at end of buffer
-    memcpy(&new[ab->len], string, len);
+    if(node->first_line == -1){
+        return &node->row;
+    }
 
-    ab->buf = new;
-    ab->len += len;
+    // Cut the row out of its span: O(log n) like any other insert
+    rownode *a, *b, *c;
+    rowTreeSplit(CONFIG.rows, at, &a, &b);
+    rowTreeSplit(b, 1, &node, &c);
+    rowMaterialize(node);
+    rowTreeSetRoot(rowTreeMerge(rowTreeMerge(a, node), c));
+    return &node->row;
 }
 
-// append buffer free
-void abFree(struct abuf *ab){
-    free(ab->buf);
+static void rowTreeWalk(rownode *node, void (*callback)(const char *, int, void *), void *arg){
+    if(node == NULL) return;
+
+    rowTreeWalk(node->left, callback, arg);
+    if(node->first_line == -1){
+        callback(node->row.chars, node->row.size, arg);
+    } else {
+        int line;
+        for(line = node->first_line; line < node->first_line + node->nlines; line++){
+            callback(&CONFIG.filebuf[CONFIG.line_start[line]], editorLineLength(line), arg);
+        }
+    }
+    rowTreeWalk(node->right, callback, arg);
 }
 
+static void rowTreeForEach(rownode *node, void (*callback)(erow *)){
+    if(node == NULL) return;
 
-/*** output ***/
-void editorDrawRows(struct abuf *ab){
-    int y;
-    for(y = 0; y < CONFIG.screenrows; y++){
-        int filerow = y + CONFIG.rowoff;
-        if (filerow >= CONFIG.numrows) {
-            // Put welcome message in top third of screen
-            if(CONFIG.numrows ==0 && y== CONFIG.screenrows / 3) {
-                // But only If text buffer is empty
-                char welcome[80];
-                int welcomelen = snprintf(welcome, sizeof(welcome), "Kilo editor -- version %s", KILO_VERSION);
+    rowTreeForEach(node->left, callback);
+    if(node->first_line == -1){
+        callback(&node->row);
+    }
+    rowTreeForEach(node->right, callback);
+}
 
-                // /* TODO:  *truncate message if screen too short
-                if(welcomelen > CONFIG.screencols) {
-                    welcomelen = CONFIG.screencols;
-                }
+/*
+ * Call back with every materialized row in order
+ */
+void editorRowsForEach(void (*callback)(erow *)){
+    rowTreeForEach(CONFIG.rows, callback);
+}
 
-                int padding = (CONFIG.screencols - welcomelen) / 2;
-                if (padding) {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while (padding--) {
-                    abAppend(ab, " ", 1);
+/*
+ * Call back with the text of every row in order, without materializing spans
+ */
+void editorRowsWalk(void (*callback)(const char *, int, void *), void *arg){
+    editorRowsIndexAll();
+    editorRowGapClose();
+    rowTreeWalk(CONFIG.rows, callback, arg);
+}
+
+int editorRowsIndexed(){
+    return CONFIG.index_pos >= CONFIG.filesize;
+}
+
+/*
+ * Index the newlines of roughly the next `bytes` bytes of the file buffer
+ * and append the lines found as one span at the end of the tree. The
+ * document is always the tree followed by the part not yet indexed, so
+ * edits made in the meantime stay where they are. Returns the number of
+ * lines added.
+ */
+int editorRowsIndexMore(size_t bytes){
+    if(editorRowsIndexed()) return 0;
+
+    size_t pos = CONFIG.index_pos;
+    size_t stop = (bytes < CONFIG.filesize - pos) ? pos + bytes : CONFIG.filesize;
+    int first = CONFIG.nlines;
+    int n = first;
+
+    while(pos < stop){
+        if((size_t) n + 2 > CONFIG.line_cap){
+            CONFIG.line_cap = CONFIG.line_cap ? CONFIG.line_cap * 2 : 1024;
+            CONFIG.line_start = realloc(CONFIG.line_start, sizeof(size_t) * CONFIG.line_cap);
+            if(CONFIG.line_start == NULL){
+                die("realloc");
+            }
+            if(CONFIG.line_cr){
+                CONFIG.line_cr = realloc(CONFIG.line_cr, sizeof(size_t) * CONFIG.line_cap);
+                if(CONFIG.line_cr == NULL){
+                    die("realloc");
                 }
-                abAppend(ab, welcome, welcomelen);
-            } else {
-                // For each row add ~\r\n to the string
-                abAppend(ab,"~", 1);
             }
-        } else {
-            int len = CONFIG.row[filerow].size - CONFIG.coloff; //Handle multiple rows
-            // because len can now be negative, need to be sure its min is 0
-            if(len < 0){
-                len = 0;
+        }
+        CONFIG.line_start[n++] = pos;
+
+        char *nl = memchr(&CONFIG.filebuf[pos], '\n', CONFIG.filesize - pos);
+        size_t end = nl ? (size_t) (nl - CONFIG.filebuf) : CONFIG.filesize;
+        size_t cr = 0;
+        while(end - cr > pos && CONFIG.filebuf[end - cr - 1] == '\r'){
+            cr++;
+        }
+        // Rows leave out the '\r' of a "\r\n", the byte counts in the tree
+        // do too
+        if(cr && CONFIG.line_cr == NULL){
+            CONFIG.line_cr = calloc(CONFIG.line_cap, sizeof(size_t));
+            if(CONFIG.line_cr == NULL){
+                die("calloc");
+            }
+        }
+        if(CONFIG.line_cr){
+            CONFIG.line_cr[n] = CONFIG.line_cr[n - 1] + cr;
+        }
+        pos = nl ? end + 1 : CONFIG.filesize + 1;
+    }
+    // One past the terminator of the last line, so every line ends at the
+    // start of the next minus one
+    CONFIG.line_start[n] = pos;
+    CONFIG.nlines = n;
+    CONFIG.index_pos = pos;
+
+    if(n > first){
+        rowTreeSetRoot(rowTreeMerge(CONFIG.rows, rowNodeNew(first, n - first)));
+        CONFIG.numrows += n - first;
+    }
+    return n - first;
+}
+
+void editorRowsIndexAll(){
+    editorRowsIndexMore((size_t) -1);
+}
+
+/*
+ * Make sure the first `rows` rows exist, if the file is that long
+ */
+void editorRowsEnsure(int rows){
+    while(CONFIG.numrows < rows && !editorRowsIndexed()){
+        editorRowsIndexMore(KILO_INDEX_CHUNK);
+    }
+}
+
+/*
+ * Take ownership of a file buffer. Nothing is indexed yet: rows are indexed
+ * as the view reaches them or while the editor is idle, so opening costs
+ * the same whatever the size of the file.
+ */
+void editorRowsLoad(char *buf, size_t len, int mapped){
+    editorRowsFree();
+
+    CONFIG.filebuf = buf;
+    CONFIG.filesize = len;
+    CONFIG.filemapped = mapped;
+    CONFIG.index_pos = 0;
+    CONFIG.syntax_valid = 0;
+    editorLexerStart();
+}
+
+void editorRowsFree(){
+    // Both threads read the file buffer
+    editorSaveWait();
+    editorLexerStop();
+    rowTreeFree(CONFIG.rows);
+    CONFIG.rows = NULL;
+    CONFIG.numrows = 0;
+    editorUndoClear();
+
+    free(CONFIG.line_start);
+    free(CONFIG.line_cr);
+    CONFIG.line_start = NULL;
+    CONFIG.line_cr = NULL;
+    CONFIG.line_cap = 0;
+    CONFIG.nlines = 0;
+    if(CONFIG.filemapped){
+        munmap(CONFIG.filebuf, CONFIG.filesize);
+    } else {
+        free(CONFIG.filebuf);
+    }
+    CONFIG.filebuf = NULL;
+    CONFIG.filesize = 0;
+    CONFIG.filemapped = 0;
+    CONFIG.index_pos = 0;
+    CONFIG.syntax_valid = 0;
+}
+
+/*** utf-8 ***/
+// Code points of two columns, East Asian wide and fullwidth plus the emoji
+// terminals draw wide. Sorted, condensed from the Unicode tables.
+static const unsigned int WIDTH_WIDE[][2] = {
+    {0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+    {0x23f0, 0x23f0}, {0x23f3, 0x23f3}, {0x25fd, 0x25fe}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267f, 0x267f}, {0x2693, 0x2693}, {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab}, {0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26ce, 0x26ce},
+    {0x26d4, 0x26d4}, {0x26ea, 0x26ea}, {0x26f2, 0x26f3}, {0x26f5, 0x26f5},
+    {0x26fa, 0x26fa}, {0x26fd, 0x26fd}, {0x2705, 0x2705}, {0x270a, 0x270b},
+    {0x2728, 0x2728}, {0x274c, 0x274c}, {0x274e, 0x274e}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27b0, 0x27b0}, {0x27bf, 0x27bf},
+    {0x2b1b, 0x2b1c}, {0x2b50, 0x2b50}, {0x2b55, 0x2b55}, {0x2e80, 0x303e},
+    {0x3041, 0x33ff}, {0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf},
+    {0xa960, 0xa97f}, {0xac00, 0xd7a3}, {0xf900, 0xfaff}, {0xfe10, 0xfe19},
+    {0xfe30, 0xfe6f}, {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x16fe0, 0x16fe4},
+    {0x17000, 0x18aff}, {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf},
+    {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a}, {0x1f200, 0x1f251}, {0x1f300, 0x1f64f},
+    {0x1f680, 0x1f6ff}, {0x1f900, 0x1f9ff}, {0x1fa70, 0x1faff}, {0x20000, 0x2fffd},
+    {0x30000, 0x3fffd}
+};
+
+// Code points of no width: combining marks, Hangul vowels and finals that
+// join the syllable before them, and invisible format characters
+static const unsigned int WIDTH_ZERO[][2] = {
+    {0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf},
+    {0x05c1, 0x05c2}, {0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a},
+    {0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x06df, 0x06e4},
+    {0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0711, 0x0711}, {0x0730, 0x074a},
+    {0x07a6, 0x07b0}, {0x07eb, 0x07f3}, {0x0816, 0x082d}, {0x0859, 0x085b},
+    {0x08d3, 0x08ff}, {0x0900, 0x0902}, {0x093a, 0x093a}, {0x093c, 0x093c},
+    {0x0941, 0x0948}, {0x094d, 0x094d}, {0x0951, 0x0957}, {0x0962, 0x0963},
+    {0x0981, 0x0981}, {0x09bc, 0x09bc}, {0x09c1, 0x09c4}, {0x09cd, 0x09cd},
+    {0x09e2, 0x09e3}, {0x0a01, 0x0a02}, {0x0a3c, 0x0a3c}, {0x0a41, 0x0a51},
+    {0x0a70, 0x0a71}, {0x0a81, 0x0a82}, {0x0abc, 0x0abc}, {0x0ac1, 0x0ac8},
+    {0x0acd, 0x0acd}, {0x0b01, 0x0b01}, {0x0b3c, 0x0b3c}, {0x0b3f, 0x0b3f},
+    {0x0b41, 0x0b44}, {0x0b4d, 0x0b4d}, {0x0bc0, 0x0bc0}, {0x0bcd, 0x0bcd},
+    {0x0c3e, 0x0c40}, {0x0c46, 0x0c56}, {0x0cbc, 0x0cbc}, {0x0ccc, 0x0ccd},
+    {0x0d41, 0x0d44}, {0x0d4d, 0x0d4d}, {0x0dca, 0x0dca}, {0x0dd2, 0x0dd6},
+    {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x0eb1, 0x0eb1},
+    {0x0eb4, 0x0ebc}, {0x0ec8, 0x0ecd}, {0x0f18, 0x0f19}, {0x0f35, 0x0f35},
+    {0x0f37, 0x0f37}, {0x0f39, 0x0f39}, {0x0f71, 0x0f7e}, {0x0f80, 0x0f84},
+    {0x0f86, 0x0f87}, {0x0f8d, 0x0fbc}, {0x0fc6, 0x0fc6}, {0x102d, 0x1030},
+    {0x1032, 0x1037}, {0x1039, 0x103a}, {0x1160, 0x11ff}, {0x135d, 0x135f},
+    {0x1712, 0x1714}, {0x17b4, 0x17b5}, {0x17b7, 0x17bd}, {0x17c6, 0x17c6},
+    {0x17c9, 0x17d3}, {0x17dd, 0x17dd}, {0x180b, 0x180e}, {0x1ab0, 0x1aff},
+    {0x1dc0, 0x1dff}, {0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x2064},
+    {0x20d0, 0x20f0}, {0x302a, 0x302d}, {0x3099, 0x309a}, {0xd7b0, 0xd7ff},
+    {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0xfeff, 0xfeff}, {0x1d167, 0x1d169},
+    {0x1d173, 0x1d182}, {0xe0001, 0xe0001}, {0xe0020, 0xe007f}, {0xe0100, 0xe01ef}
+};
+
+// Set the ranges of one list that fall in the block at `first` to width.
+// *next is the first range that doesn't end before the block. Returns
+// whether the block was touched.
+static int widthFill(unsigned char *block, const unsigned int (*ranges)[2], size_t n,
+                     size_t *next, unsigned int first, int width){
+    while(*next < n && ranges[*next][1] < first){
+        (*next)++;
+    }
+    int touched = 0;
+    size_t k;
+    for(k = *next; k < n && ranges[k][0] <= first + 255; k++){
+        unsigned int cp = ranges[k][0] > first ? ranges[k][0] : first;
+        unsigned int last = ranges[k][1] < first + 255 ? ranges[k][1] : first + 255;
+        for(; cp <= last; cp++){
+            int shift = (cp & 3) * 2;
+            block[(cp & 0xff) >> 2] = (block[(cp & 0xff) >> 2] & ~(3 << shift)) | width << shift;
+        }
+        touched = 1;
+    }
+    return touched;
+}
+
+/*
+ * Build the width table from the range lists. Most blocks of 256 code
+ * points are one column throughout and share block 0, the few dozen others
+ * are kept once each.
+ */
+void editorWidthInit(){
+    unsigned char block[64];
+    size_t wide = 0;
+    size_t zero = 0;
+    int nblocks = 1;
+    unsigned int b;
+
+    memset(WIDTH_BLOCKS[0], 0x55, sizeof(WIDTH_BLOCKS[0]));
+    for(b = 0; b < sizeof(WIDTH_INDEX); b++){
+        memset(block, 0x55, sizeof(block));
+        // Zero goes last, a few marks sit inside the wide ranges
+        int touched = widthFill(block, WIDTH_WIDE, sizeof(WIDTH_WIDE) / sizeof(WIDTH_WIDE[0]), &wide, b << 8, 2);
+        touched |= widthFill(block, WIDTH_ZERO, sizeof(WIDTH_ZERO) / sizeof(WIDTH_ZERO[0]), &zero, b << 8, 0);
+
+        int k = 0;
+        if(touched){
+            for(k = 0; k < nblocks && memcmp(WIDTH_BLOCKS[k], block, sizeof(block)) != 0; k++);
+            if(k == nblocks && nblocks < 256){
+                memcpy(WIDTH_BLOCKS[nblocks++], block, sizeof(block));
+            } else if(k == nblocks){
+                k = 0;
+            }
+        }
+        WIDTH_INDEX[b] = k;
+    }
+}
+
+/*
+ * Decode the UTF-8 sequence at s. Returns its length, or 0 if it isn't a
+ * valid one: a stray continuation byte, a sequence cut short, an overlong
+ * form, a surrogate or anything past U+10FFFF.
+ */
+int editorUtf8Decode(const char *s, int len, unsigned int *cp){
+    const unsigned char *u = (const unsigned char *) s;
+    unsigned int min;
+    int n;
+    if(u[0] < 0x80){
+        *cp = u[0];
+        return 1;
+    } else if(u[0] < 0xc2){
+        return 0;
+    } else if(u[0] < 0xe0){
+        n = 2;
+        min = 0x80;
+        *cp = u[0] & 0x1f;
+    } else if(u[0] < 0xf0){
+        n = 3;
+        min = 0x800;
+        *cp = u[0] & 0x0f;
+    } else if(u[0] < 0xf5){
+        n = 4;
+        min = 0x10000;
+        *cp = u[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if(len < n) return 0;
+
+    int i;
+    for(i = 1; i < n; i++){
+        if((u[i] & 0xc0) != 0x80) return 0;
+        *cp = *cp << 6 | (u[i] & 0x3f);
+    }
+    if(*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff)){
+        return 0;
+    }
+    return n;
+}
+
+int editorCharWidth(unsigned int cp){
+    return (WIDTH_BLOCKS[WIDTH_INDEX[cp >> 8]][(cp & 0xff) >> 2] >> ((cp & 3) * 2)) & 3;
+}
+
+/*
+ * Length and width of the character cell at s. Bytes that don't decode and
+ * C1 controls are one column, they are drawn as an inverse '?'. Tabs are up
+ * to the caller.
+ */
+int editorCellWidth(const char *s, int len, int *width){
+    unsigned int cp;
+    int n = editorUtf8Decode(s, len, &cp);
+    if(n == 0){
+        *width = 1;
+        return 1;
+    }
+    *width = cp < 0xa0 ? 1 : editorCharWidth(cp);
+    return n;
+}
+
+// Length of the leading run of s without bytes >= 128
+static int utf8AsciiPrefix(const char *s, int len){
+    int j = 0;
+#if defined(__SSE2__)
+    for(; j + 16 <= len; j += 16){
+        int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) &s[j]));
+        if(high){
+            return j + __builtin_ctz(high);
+        }
+    }
+#endif
+    while(j < len && (unsigned char) s[j] < 0x80){
+        j++;
+    }
+    return j;
+}
+
+/*
+ * Bytes of s that fit in cols columns without splitting a character, and
+ * the columns they take. ASCII is one column a byte and isn't decoded.
+ */
+static int utf8Fit(const char *s, int len, int cols, int *used){
+    int n = len < cols ? len : cols;
+    int j = utf8AsciiPrefix(s, n);
+    int col = j;
+    if(j < n){
+        while(j < len){
+            int width;
+            int bytes = editorCellWidth(&s[j], len - j, &width);
+            if(col + width > cols) break;
+            col += width;
+            j += bytes;
+        }
+    }
+    *used = col;
+    return j;
+}
+
+/*** render cache ***/
+static void cacheUnlink(erow *row){
+    if(row->lru_prev){
+        row->lru_prev->lru_next = row->lru_next;
+    } else {
+        CONFIG.lru_head = row->lru_next;
+    }
+    if(row->lru_next){
+        row->lru_next->lru_prev = row->lru_prev;
+    } else {
+        CONFIG.lru_tail = row->lru_prev;
+    }
+    row->lru_prev = row->lru_next = NULL;
+}
+
+static void cachePushFront(erow *row){
+    row->lru_prev = NULL;
+    row->lru_next = CONFIG.lru_head;
+    if(CONFIG.lru_head){
+        CONFIG.lru_head->lru_prev = row;
+    } else {
+        CONFIG.lru_tail = row;
+    }
+    CONFIG.lru_head = row;
+    row->lru_frame = CONFIG.frame;
+}
+
+static size_t cacheCost(erow *row){
+    return row->rsize + 1 + row->rsize + row->ncheckpoints * sizeof(struct rowCheckpoint);
+}
+
+/*
+ * Evict the coldest rows until we are back under budget. Rows used in the
+ * frame being built stay, even if that means going over for a while, and
+ * so does the row being typed into.
+ */
+static void cacheTrim(){
+    while(CONFIG.cache_bytes > CONFIG.cache_budget && CONFIG.lru_tail &&
+          CONFIG.lru_tail->lru_frame != CONFIG.frame){
+        if(CONFIG.lru_tail == CONFIG.gap_row){
+            erow *row = CONFIG.lru_tail;
+            cacheUnlink(row);
+            cachePushFront(row);
+            continue;
+        }
+        editorRowInvalidate(CONFIG.lru_tail);
+        CONFIG.cache_evictions++;
+    }
+}
+
+/*
+ * Drop the render/hl cache of a row, it gets rebuilt the next time the row
+ * is drawn or searched
+ */
+void editorRowInvalidate(erow *row){
+    if(row->render == NULL) return;
+
+    CONFIG.cache_bytes -= cacheCost(row);
+    cacheUnlink(row);
+    editorRowFree(row->render, row->render_cap);
+    editorRowFree(row->hl, row->render_cap);
+    editorRowFree(row->checkpoints, row->ncheckpoints * sizeof(struct rowCheckpoint));
+    row->render = NULL;
+    row->hl = NULL;
+    row->checkpoints = NULL;
+    row->ncheckpoints = 0;
+    row->rsize = 0;
+}
+
+/*
+ * Classify a run of bytes: returns ROW_HAS_* flags, counts tabs and counts
+ * the bytes that can start a UTF-8 sequence. The vector versions look at 16
+ * or 32 bytes per step; a signed compare against 0x20 catches control
+ * bytes and bytes >= 128 in one go, and the bytes it flags are sorted out
+ * one by one, which is rare outside binary files and UTF-8.
+ */
+static int renderClassifyScalar(const char *s, int len, int *tabs, int *leads){
+    int flags = 0;
+    int j;
+    for(j = 0; j < len; j++){
+        unsigned char c = s[j];
+        if(c == '\t'){
+            (*tabs)++;
+            flags |= ROW_HAS_TAB;
+        } else if(c < 0x20 || c == 0x7f){
+            flags |= ROW_HAS_CTRL;
+        } else if(c >= 0x80){
+            *leads += c >= 0xc0;
+            flags |= ROW_HAS_HIGH;
+        }
+    }
+    return flags;
+}
+
+#if defined(__SSE2__)
+static int renderClassifySSE2(const char *s, int len, int *tabs, int *leads){
+    const __m128i low = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    int flags = 0;
+    int j = 0;
+    for(; j + 16 <= len; j += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *) &s[j]);
+        __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, low), _mm_cmpeq_epi8(v, del));
+        if(_mm_movemask_epi8(special)){
+            flags |= renderClassifyScalar(&s[j], 16, tabs, leads);
+        }
+    }
+    return flags | renderClassifyScalar(&s[j], len - j, tabs, leads);
+}
+#endif
+
+#if defined(KILO_HAVE_AVX2)
+__attribute__((target("avx2")))
+static int renderClassifyAVX2(const char *s, int len, int *tabs, int *leads){
+    const __m256i low = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    int flags = 0;
+    int j = 0;
+    for(; j + 32 <= len; j += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *) &s[j]);
+        __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(low, v), _mm256_cmpeq_epi8(v, del));
+        if(_mm256_movemask_epi8(special)){
+            flags |= renderClassifyScalar(&s[j], 32, tabs, leads);
+        }
+    }
+    return flags | renderClassifyScalar(&s[j], len - j, tabs, leads);
+}
+#endif
+
+static int renderClassify(const char *s, int len, int *tabs, int *leads){
+#if defined(KILO_HAVE_AVX2)
+    static int avx2 = -1;
+    if(avx2 == -1){
+        avx2 = __builtin_cpu_supports("avx2");
+    }
+    if(avx2){
+        return renderClassifyAVX2(s, len, tabs, leads);
+    }
+#endif
+#if defined(__SSE2__)
+    return renderClassifySSE2(s, len, tabs, leads);
+#else
+    return renderClassifyScalar(s, len, tabs, leads);
+#endif
+}
+
+// Note a character that isn't one column and one render byte per byte of
+// chars, as part of the last run if it carries that run on
+static void rowCheckpointAdd(erow *row, int cx, int rx, int ridx, int len, int width){
+    if(row->ncheckpoints){
+        struct rowCheckpoint *last = &row->checkpoints[row->ncheckpoints - 1];
+        if(last->len == len && last->width == width && last->cx + last->count * len == cx){
+            last->count++;
+            return;
+        }
+    }
+    struct rowCheckpoint *c = &row->checkpoints[row->ncheckpoints++];
+    c->cx = cx;
+    c->rx = rx;
+    c->ridx = ridx;
+    c->count = 1;
+    c->len = len;
+    c->width = width;
+}
+
+/*
+ * Render a row holding bytes >= 128. UTF-8 sequences are copied as they
+ * are and take the width the table gives them, tab stops go by columns
+ * rather than by render bytes. Returns the render length.
+ */
+static int rowRenderUtf8(erow *row){
+    int idx = 0;
+    int rx = 0;
+    int j = 0;
+    while(j < row->size){
+        unsigned char c = row->chars[j];
+        if(c == '\t'){
+            int width = KILO_TAB_STOP - rx % KILO_TAB_STOP;
+            if(width > 1){
+                rowCheckpointAdd(row, j, rx, idx, 1, width);
+            }
+            memset(&row->render[idx], ' ', width);
+            idx += width;
+            rx += width;
+            j++;
+        } else if(c < 0x80){
+            row->render[idx++] = c;
+            rx++;
+            j++;
+        } else {
+            int width;
+            int len = editorCellWidth(&row->chars[j], row->size - j, &width);
+            if(len > 1){
+                rowCheckpointAdd(row, j, rx, idx, len, width);
+            }
+            memcpy(&row->render[idx], &row->chars[j], len);
+            idx += len;
+            rx += width;
+            j += len;
+        }
+    }
+    return idx;
+}
+
+/*
+ * Make sure render and hl are up to date before anything reads them
+ */
+void editorRowRender(erow *row){
+    if(row->render){
+        CONFIG.cache_hits++;
+        cacheUnlink(row);
+        cachePushFront(row);
+        return;
+    }
+    CONFIG.cache_misses++;
+    if(row == CONFIG.gap_row){
+        editorRowGapClose();
+    }
+
+    int tabs = 0;
+    int leads = 0;
+    row->render_flags = renderClassify(row->chars, row->size, &tabs, &leads);
+    row->render = editorRowAlloc(row->size + tabs*(KILO_TAB_STOP -1) + 1, &row->render_cap);
+    // At most one run per tab and per sequence
+    int bound = tabs + leads;
+    row->checkpoints = bound ? editorRowAlloc(bound * sizeof(struct rowCheckpoint), NULL) : NULL;
+    row->ncheckpoints = 0;
+
+    int idx = 0;
+    int j = 0;
+
+    if(row->render_flags & ROW_HAS_HIGH){
+        idx = rowRenderUtf8(row);
+    } else {
+        // Copy the runs between tabs in bulk, columns are render bytes
+        while(j < row->size){
+            char *tab = tabs ? memchr(&row->chars[j], '\t', row->size - j) : NULL;
+            int run = tab ? tab - &row->chars[j] : row->size - j;
+
+            memcpy(&row->render[idx], &row->chars[j], run);
+            idx += run;
+            j += run;
+
+            if(tab){
+                int width = KILO_TAB_STOP - idx % KILO_TAB_STOP;
+                if(width > 1){
+                    rowCheckpointAdd(row, j, idx, idx, 1, width);
+                }
+                memset(&row->render[idx], ' ', width);
+                idx += width;
+                j++;
+            }
+        }
+    }
+
+    row->render[idx] = '\0';
+    row->rsize = idx;
+
+    // Runs merge, so the table is often shorter than the bound
+    if(row->ncheckpoints < bound){
+        struct rowCheckpoint *fit = NULL;
+        if(row->ncheckpoints){
+            fit = editorRowAlloc(row->ncheckpoints * sizeof(struct rowCheckpoint), NULL);
+            memcpy(fit, row->checkpoints, row->ncheckpoints * sizeof(struct rowCheckpoint));
+        }
+        editorRowFree(row->checkpoints, bound * sizeof(struct rowCheckpoint));
+        row->checkpoints = fit;
+    }
+
+    rownode *node = (rownode *) ((char *) row - offsetof(rownode, row));
+    if(editorSyntaxTracked() && !node->state_valid){
+        // Plain until the state above is known, syntaxRelex() drops the
+        // cache once it is
+        editorUpdateSyntax(row, HL_STATE_NONE);
+    } else {
+        editorUpdateSyntax(row, node->state_in);
+    }
+
+    CONFIG.cache_bytes += cacheCost(row);
+    cachePushFront(row);
+    cacheTrim();
+}
+
+/*
+ * Cache budget in bytes from KILO_CACHE_BUDGET, with an optional K, M or G
+ */
+void editorCacheInit(){
+    CONFIG.cache_budget = KILO_CACHE_BUDGET;
+
+    char *env = getenv("KILO_CACHE_BUDGET");
+    if(env == NULL) return;
+
+    char *end;
+    unsigned long long budget = strtoull(env, &end, 10);
+    switch(*end){
+        case 'g': case 'G': budget <<= 10; /* fall through */
+        case 'm': case 'M': budget <<= 10; /* fall through */
+        case 'k': case 'K': budget <<= 10; break;
+    }
+    if(end != env){
+        CONFIG.cache_budget = budget;
+    }
+}
+
+/*** row operations ***/
+/*
+ * Move the text after the gap back, so the row being typed into has its
+ * chars in one piece again. Only typing keeps a gap open, anything else
+ * that may read whole rows closes it first.
+ */
+void editorRowGapClose(){
+    erow *row = CONFIG.gap_row;
+    if(row == NULL) return;
+
+    memmove(&row->chars[CONFIG.gap_at], &row->chars[CONFIG.gap_at + CONFIG.gap_len],
+            row->size - CONFIG.gap_at + 1);
+    CONFIG.gap_row = NULL;
+    CONFIG.gap_len = 0;
+}
+
+// The byte at `at` in row, stepping over the gap if it has one
+static const char *rowByte(erow *row, int at){
+    if(CONFIG.gap_row == row && at >= CONFIG.gap_at){
+        at += CONFIG.gap_len;
+    }
+    return &row->chars[at];
+}
+
+// Make sure the gap sits at `at` in row and has room for a byte
+static void rowGapOpen(erow *row, int at){
+    if(CONFIG.gap_row == row && CONFIG.gap_at == at && CONFIG.gap_len > 0) return;
+    editorRowGapClose();
+
+    // Growing is geometric, so reopening a full gap is amortized O(1)
+    if(row->cap < row->size + 2){
+        row->chars = editorRowGrow(row->chars, &row->cap, row->size + 2);
+    }
+    CONFIG.gap_len = row->cap - row->size - 1;
+    memmove(&row->chars[at + CONFIG.gap_len], &row->chars[at], row->size - at + 1);
+    CONFIG.gap_row = row;
+    CONFIG.gap_at = at;
+}
+
+// Open or close a one byte hole at `at` in render and hl
+static void rowRenderShift(erow *row, int at, int insert){
+    CONFIG.cache_bytes -= cacheCost(row);
+    if(insert){
+        if(row->rsize + 2 > row->render_cap){
+            int cap = row->render_cap;
+            row->render = editorRowGrow(row->render, &cap, row->rsize + 2);
+            row->hl = editorRowGrow(row->hl, &row->render_cap, row->rsize + 2);
+        }
+        memmove(&row->render[at + 1], &row->render[at], row->rsize - at + 1);
+        memmove(&row->hl[at + 1], &row->hl[at], row->rsize - at);
+        row->rsize++;
+    } else {
+        memmove(&row->render[at], &row->render[at + 1], row->rsize - at);
+        memmove(&row->hl[at], &row->hl[at + 1], row->rsize - at - 1);
+        row->rsize--;
+    }
+    CONFIG.cache_bytes += cacheCost(row);
+}
+
+/*
+ * Colour a row again after a one byte edit at `at`. Lexing starts from the
+ * last plain separator before the edit and stops once it agrees with the
+ * old colours after `resync`, so only the tokens around the edit are
+ * looked at.
+ */
+static void rowRelexAround(erow *row, int at, int resync){
+    if(CONFIG.syntax == NULL || row->hl_state == HL_STATE_NONE){
+        if(at < row->rsize){
+            row->hl[at] = HL_NORMAL;
+        }
+        return;
+    }
+
+    // A plain separator can still turn into a comment start once the bytes
+    // after it change, so begin far enough back that those are untouched
+    char *scs = CONFIG.syntax->singleline_comment_start;
+    char *mcs = CONFIG.syntax->multiline_comment_start;
+    int lookahead = scs ? strlen(scs) : 1;
+    if(mcs && (int) strlen(mcs) > lookahead){
+        lookahead = strlen(mcs);
+    }
+    int from = at - lookahead + 1;
+    if(from < 0){
+        from = 0;
+    }
+    while(from > 0 && !(row->hl[from - 1] == HL_NORMAL &&
+                        SEPARATORS[(unsigned char) row->render[from - 1]])){
+        from--;
+    }
+    int state = syntaxHighlight(row, from, from ? 0 : row->hl_state, resync);
+    if(state == -1) return;
+
+    // The row now ends in a different state, the rows below follow it
+    rownode *node = (rownode *) ((char *) row - offsetof(rownode, row));
+    if(node->state_valid && node->state_out != state){
+        node->state_out = state;
+        int below = editorRowIndex(row) + 1;
+        if(below < CONFIG.numrows){
+            editorSyntaxUpdate(below);
+        }
+    }
+}
+
+/*
+ * Typing fast path. The render of a plain ASCII row is a copy of chars,
+ * so a byte typed or deleted can be applied to the cached render and hl in
+ * place. chars itself keeps a gap at the cursor. Returns 0 if the row
+ * doesn't qualify and has to be rebuilt instead.
+ */
+static int rowPatch(erow *row, int at, int input, int insert){
+    if(row->render == NULL || (row->render_flags & (ROW_HAS_TAB | ROW_HAS_CTRL | ROW_HAS_HIGH))){
+        return 0;
+    }
+    if(insert && (iscntrl((unsigned char) input) || (unsigned char) input >= 128)){
+        return 0;
+    }
+
+    if(insert){
+        rowGapOpen(row, at);
+        row->chars[CONFIG.gap_at++] = input;
+        CONFIG.gap_len--;
+        row->size++;
+        rowRenderShift(row, at, 1);
+        rowTreeResized(row);
+        row->render[at] = input;
+        rowRelexAround(row, at, at + 1);
+    } else {
+        rowGapOpen(row, at + 1);
+        CONFIG.gap_at--;
+        CONFIG.gap_len++;
+        row->size--;
+        rowRenderShift(row, at, 0);
+        rowTreeResized(row);
+        rowRelexAround(row, at, at);
+    }
+    CONFIG.dirty++;
+    return 1;
+}
+
+/*
+ * Called whenever chars changed
+ */
+void editorUpdateRow(erow *row){
+    rowTreeResized(row);
+    editorRowInvalidate(row);
+    editorSyntaxUpdate(editorRowIndex(row));
+}
+
+void editorInsertRow(int at, char* s, size_t len){
+    if(at < 0 || at > CONFIG.numrows) return;
+    editorJournalRecord(JOURNAL_INSERT_ROW, at, 0, s, len);
+    editorUndoRecord(UNDO_INSERT_ROW, at, 0, s, len);
+
+    rownode *node = rowNodeNew(-1, 1);
+    erow *row = &node->row;
+
+    row->size = len;
+    row->chars = editorRowAlloc(len + 1, &row->cap);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    rowNodeUpdate(node);
+
+    rownode *left, *right;
+    rowTreeSplit(CONFIG.rows, at, &left, &right);
+    rowTreeSetRoot(rowTreeMerge(rowTreeMerge(left, node), right));
+
+    CONFIG.numrows++;
+    CONFIG.dirty++;
+    if(at < CONFIG.syntax_valid){
+        node->state_valid = 1;
+        CONFIG.syntax_valid++;
+        editorSyntaxUpdate(at);
+    }
+}
+void editorFreeRow(erow *row){
+    if(CONFIG.gap_row == row){
+        CONFIG.gap_row = NULL;
+    }
+    editorRowInvalidate(row);
+    editorRowFree(row->chars, row->cap);
+}
+
+void editorDelRow(int at){
+    if( at < 0 || at >= CONFIG.numrows) return;
+    editorJournalRecord(JOURNAL_DEL_ROW, at, 0, NULL, 0);
+    editorRowGapClose();
+
+    rownode *left, *node, *right;
+    rowTreeSplit(CONFIG.rows, at, &left, &node);
+    rowTreeSplit(node, 1, &node, &right);
+    if(node->first_line >= 0){
+        editorUndoRecord(UNDO_DEL_ROW, at, 0, &CONFIG.filebuf[CONFIG.line_start[node->first_line]],
+                         editorLineLength(node->first_line));
+    } else {
+        editorUndoRecord(UNDO_DEL_ROW, at, 0, node->row.chars, node->row.size);
+    }
+    rowNodeFree(node);
+    rowTreeSetRoot(rowTreeMerge(left, right));
+
+    CONFIG.numrows--;
+    CONFIG.dirty++;
+    if(at < CONFIG.syntax_valid){
+        CONFIG.syntax_valid--;
+        editorSyntaxUpdate(at);
+    }
+}
+void editorRowInsertChar(erow * row, int at, int input){
+    if(at < 0 || at > row->size){
+        at = row->size;
+    }
+    char c = input;
+    int y = editorRowIndex(row);
+    editorJournalRecord(JOURNAL_INSERT_CHAR, y, at, &c, 1);
+    editorUndoRecord(UNDO_INSERT_TEXT, y, at, &c, 1);
+    if(rowPatch(row, at, input, 1)) return;
+    editorRowGapClose();
+
+    row->chars = editorRowGrow(row->chars, &row->cap, row->size + 2); //make sure there is space for new char and nullbyte
+    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+    row->size++;
+    row->chars[at] = input;
+    editorUpdateRow(row);
+    CONFIG.dirty++;
+}
+
+void editorRowDelChar(erow *row, int at){
+    if(at < 0 || at >=row->size) return;
+    int y = editorRowIndex(row);
+    editorJournalRecord(JOURNAL_DEL_CHAR, y, at, NULL, 0);
+    editorUndoRecord(UNDO_DEL_TEXT, y, at, rowByte(row, at), 1);
+    if(rowPatch(row, at, 0, 0)) return;
+    editorRowGapClose();
+
+    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+    row->size--;
+    editorUpdateRow(row);
+    CONFIG.dirty++;
+}
+
+// Positions in a row are counted in chars (field 0), in columns (field 1)
+// or in render bytes (field 2)
+static int checkpointAt(struct rowCheckpoint *c, int field){
+    return field == 0 ? c->cx : field == 1 ? c->rx : c->ridx;
+}
+
+// What each character of the run takes in a field
+static int checkpointStep(struct rowCheckpoint *c, int field){
+    // A tab renders as its width in spaces, a sequence as itself
+    return field == 0 ? c->len : field == 1 ? c->width : c->len == 1 ? c->width : c->len;
+}
+
+/*
+ * Convert a position from one field to another with the checkpoints of a
+ * rendered row. Everything between two runs is one byte, one column. A
+ * position inside a character maps to the start of that character, unless
+ * the character takes the same in both fields: a column inside a tab is a
+ * space of its render.
+ */
+static int rowConvert(erow *row, int from, int to, int value){
+    int lo = 0;
+    int hi = row->ncheckpoints;
+    while(lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        if(checkpointAt(&row->checkpoints[mid], from) <= value){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if(lo == 0) return value;
+
+    struct rowCheckpoint *c = &row->checkpoints[lo - 1];
+    int offset = value - checkpointAt(c, from);
+    int step = checkpointStep(c, from);
+    if(offset < c->count * step){
+        int rest = step == checkpointStep(c, to) ? offset % step : 0;
+        return checkpointAt(c, to) + offset / step * checkpointStep(c, to) + rest;
+    }
+    return checkpointAt(c, to) + c->count * checkpointStep(c, to) + offset - c->count * step;
+}
+
+int editorRowCxToRx(erow *row, int cx){
+    // Without tabs or UTF-8 every byte is one column
+    if(row->render && row->ncheckpoints == 0){
+        return cx;
+    }
+    // Otherwise columns go one per byte from the last run before cx
+    if(row->render){
+        return rowConvert(row, 0, 1, cx);
+    }
+    // The walk below reads chars whole
+    if(row == CONFIG.gap_row){
+        editorRowGapClose();
+    }
+    int rx = 0;
+    int j = 0;
+    while(j < cx){
+        int width;
+        int len = 1;
+        if(row->chars[j] == '\t'){
+            width = KILO_TAB_STOP - rx % KILO_TAB_STOP;
+        } else {
+            len = editorCellWidth(&row->chars[j], row->size - j, &width);
+        }
+        if(j + len > cx) break;
+        rx += width;
+        j += len;
+    }
+    return rx;
+}
+
+int editorRowRxToCx(erow *row, int rx){
+    if(row->render){
+        int cx = rowConvert(row, 1, 0, rx);
+        return cx < row->size ? cx : row->size;
+    }
+
+    if(row == CONFIG.gap_row){
+        editorRowGapClose();
+    }
+    int cur_rx = 0;
+    int cx = 0;
+    while(cx < row->size){
+        int width;
+        int len = 1;
+        if(row->chars[cx] == '\t'){
+            width = KILO_TAB_STOP - cur_rx % KILO_TAB_STOP;
+        } else {
+            len = editorCellWidth(&row->chars[cx], row->size - cx, &width);
+        }
+        cur_rx += width;
+
+        if(cur_rx > rx){
+            return cx;
+        }
+        cx += len;
+    }
+    return cx;
+}
+
+// Length and width of the character cell at cx
+static int rowCellAt(erow *row, int cx, int *width){
+    if(row == CONFIG.gap_row){
+        editorRowGapClose();
+    }
+    return editorCellWidth(&row->chars[cx], row->size - cx, width);
+}
+
+// Start of the character cell byte cx is part of
+static int rowCharStart(erow *row, int cx){
+    int at = cx;
+    while(at > 0 && cx - at < 3 && (*rowByte(row, at) & 0xc0) == 0x80){
+        at--;
+    }
+    if(at == cx) return cx;
+    int width;
+    int len = (unsigned char) *rowByte(row, at) < 0x80 ? 1 : rowCellAt(row, at, &width);
+    return at + len > cx ? at : cx;
+}
+
+/*
+ * Where the cursor goes from cx one character on or back. Marks of no
+ * width go with the character before them, the cursor never stops
+ * between the two.
+ */
+static int rowCharNext(erow *row, int cx){
+    int width;
+    cx += (unsigned char) *rowByte(row, cx) < 0x80 ? 1 : rowCellAt(row, cx, &width);
+    while(cx < row->size && (unsigned char) *rowByte(row, cx) >= 0x80){
+        int len = rowCellAt(row, cx, &width);
+        if(width) break;
+        cx += len;
+    }
+    return cx;
+}
+
+static int rowCharPrev(erow *row, int cx){
+    while(cx > 0){
+        cx = rowCharStart(row, cx - 1);
+        if((unsigned char) *rowByte(row, cx) < 0x80) break;
+        int width;
+        rowCellAt(row, cx, &width);
+        if(width) break;
+    }
+    return cx;
+}
+
+/*
+ * Index into render of the character at cx, the row has to be rendered
+ */
+int editorRowCxToRender(erow *row, int cx){
+    return rowConvert(row, 0, 2, cx);
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len){
+    editorRowGapClose();
+    int y = editorRowIndex(row);
+    editorJournalRecord(JOURNAL_APPEND, y, 0, s, len);
+    editorUndoRecord(UNDO_INSERT_TEXT, y, row->size, s, len);
+    row->chars = editorRowGrow(row->chars, &row->cap, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    CONFIG.dirty++;
+}
+
+/*
+ * Cut a row short at `at`
+ */
+void editorRowTruncate(erow *row, int at){
+    if(at < 0 || at >= row->size) return;
+    editorRowGapClose();
+    int y = editorRowIndex(row);
+    editorJournalRecord(JOURNAL_TRUNCATE, y, at, NULL, 0);
+    editorUndoRecord(UNDO_DEL_TEXT, y, at, &row->chars[at], row->size - at);
+    row->size = at;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    CONFIG.dirty++;
+}
+
+/*** editor operations **/
+void editorInsertChar(int input){
+    if(CONFIG.cy == CONFIG.numrows){
+        editorInsertRow(CONFIG.numrows,"", 0);
+    }
+    editorRowInsertChar(editorRowAt(CONFIG.cy), CONFIG.cx, input);
+    CONFIG.cx++;
+}
+
+void editorInsertNewline() {
+  if (CONFIG.cx == 0) {
+    editorInsertRow(CONFIG.cy, "", 0);
+  } else {
+    erow *row = editorRowAt(CONFIG.cy);
+
+    editorInsertRow(CONFIG.cy + 1, &row->chars[CONFIG.cx], row->size - CONFIG.cx);
+    editorRowTruncate(editorRowAt(CONFIG.cy), CONFIG.cx);
+  }
+  CONFIG.cy++;
+  CONFIG.cx = 0;
+}
+
+/*
+ * Insert a block of text at the cursor, with lines split on \r, \n or \r\n.
+ * Pastes come through here so the rows are only redone once per line
+ * instead of once per byte.
+ */
+void editorInsertText(char *s, size_t len){
+    editorRowGapClose();
+    if(CONFIG.cy == CONFIG.numrows){
+        editorInsertRow(CONFIG.numrows, "", 0);
+    }
+
+    // What follows the cursor ends up after the inserted text
+    erow *row = editorRowAt(CONFIG.cy);
+    int tail_len = row->size - CONFIG.cx;
+    char *tail = malloc(tail_len + 1);
+    if(tail == NULL){
+        die("malloc");
+    }
+    memcpy(tail, &row->chars[CONFIG.cx], tail_len);
+    editorRowTruncate(row, CONFIG.cx);
+
+    size_t start = 0;
+    size_t i;
+    for(i = 0; i <= len; i++){
+        if(i < len && s[i] != '\r' && s[i] != '\n') continue;
+
+        if(start == 0){
+            editorRowAppendString(row, s, i);
+            CONFIG.cx += i;
+        } else {
+            CONFIG.cy++;
+            editorInsertRow(CONFIG.cy, &s[start], i - start);
+            CONFIG.cx = i - start;
+        }
+        if(i + 1 < len && s[i] == '\r' && s[i + 1] == '\n'){
+            i++;
+        }
+        start = i + 1;
+    }
+
+    editorRowAppendString(editorRowAt(CONFIG.cy), tail, tail_len);
+    free(tail);
+}
+
+void editorDelChar(){
+    // if the cursor is past the end of the file there is nothing to delete
+    if(CONFIG.cy == CONFIG.numrows) return;
+    if(CONFIG.cx == 0 && CONFIG.cy == 0) return;
+
+    erow *row = editorRowAt(CONFIG.cy);
+    if(CONFIG.cx > 0){
+        // The whole character goes, with any marks on it
+        int prev = rowCharPrev(row, CONFIG.cx);
+        while(CONFIG.cx > prev){
+            editorRowDelChar(row, prev);
+            CONFIG.cx--;
+        }
+    } else {
+        editorRowGapClose();
+        CONFIG.cx = editorRowAt(CONFIG.cy - 1)->size;
+        editorRowAppendString(editorRowAt(CONFIG.cy -1), row->chars, row->size);
+        editorDelRow(CONFIG.cy);
+        CONFIG.cy--;
+    }
+}
+
+/*** file i/o ***/
+
+static void saverPiece(const char *s, size_t len){
+    if(len == 0) return;
+    SAVER.bytes += len;
+    if(SAVER.npieces > 0){
+        struct iovec *last = &SAVER.pieces[SAVER.npieces - 1];
+        if((char *) last->iov_base + last->iov_len == s){
+            last->iov_len += len;
+            return;
+        }
+    }
+    if(SAVER.npieces == SAVER.piece_cap){
+        SAVER.piece_cap = SAVER.piece_cap ? SAVER.piece_cap * 2 : 256;
+        SAVER.pieces = realloc(SAVER.pieces, sizeof(struct iovec) * SAVER.piece_cap);
+        if(SAVER.pieces == NULL){
+            die("realloc");
+        }
+    }
+    SAVER.pieces[SAVER.npieces].iov_base = (char *) s;
+    SAVER.pieces[SAVER.npieces].iov_len = len;
+    SAVER.npieces++;
+}
+
+// Room for `len` bytes in the copy blocks, rows copied one after another
+// stay next to each other so they become one piece
+static char *saverCopy(size_t len){
+    if(SAVER.nblocks == 0 || SAVER.block_used + len > SAVER.block_size){
+        if(SAVER.nblocks == SAVER.block_cap){
+            SAVER.block_cap = SAVER.block_cap ? SAVER.block_cap * 2 : 16;
+            SAVER.blocks = realloc(SAVER.blocks, sizeof(char *) * SAVER.block_cap);
+            if(SAVER.blocks == NULL){
+                die("realloc");
+            }
+        }
+        SAVER.block_size = len > KILO_SAVE_BLOCK ? len : KILO_SAVE_BLOCK;
+        SAVER.blocks[SAVER.nblocks] = malloc(SAVER.block_size);
+        if(SAVER.blocks[SAVER.nblocks] == NULL){
+            die("malloc");
+        }
+        SAVER.nblocks++;
+        SAVER.block_used = 0;
+    }
+    char *copy = &SAVER.blocks[SAVER.nblocks - 1][SAVER.block_used];
+    SAVER.block_used += len;
+    return copy;
+}
+
+static void saverPart(const char *s, size_t len, int raw){
+    if(len == 0) return;
+    if(SAVER.nparts > 0){
+        struct saverPart *last = &SAVER.parts[SAVER.nparts - 1];
+        if(last->raw == raw && last->s + last->len == s){
+            last->len += len;
+            return;
+        }
+    }
+    if(SAVER.nparts == SAVER.part_cap){
+        SAVER.part_cap = SAVER.part_cap ? SAVER.part_cap * 2 : 256;
+        SAVER.parts = realloc(SAVER.parts, sizeof(struct saverPart) * SAVER.part_cap);
+        if(SAVER.parts == NULL){
+            die("realloc");
+        }
+    }
+    SAVER.parts[SAVER.nparts].s = s;
+    SAVER.parts[SAVER.nparts].len = len;
+    SAVER.parts[SAVER.nparts].raw = raw;
+    SAVER.nparts++;
+}
+
+/*
+ * Snapshot the tree a node at a time. An untouched span is one stretch of
+ * the file buffer, only rows that were edited get copied.
+ */
+static void saverNode(rownode *node){
+    if(node == NULL) return;
+
+    saverNode(node->left);
+    if(node->first_line == -1){
+        char *copy = saverCopy(node->row.size + 1);
+        memcpy(copy, node->row.chars, node->row.size);
+        copy[node->row.size] = '\n';
+        saverPart(copy, node->row.size + 1, 0);
+    } else {
+        int first = node->first_line;
+        int last = first + node->nlines;
+        size_t start = CONFIG.line_start[first];
+        size_t end = CONFIG.line_start[last];
+        int cr = CONFIG.line_cr && CONFIG.line_cr[last] != CONFIG.line_cr[first];
+        // The last line of a file may have no newline of its own
+        if(end > CONFIG.filesize){
+            end = CONFIG.filesize;
+        }
+        saverPart(&CONFIG.filebuf[start], end - start, cr);
+        if(!cr && CONFIG.filebuf[end - 1] != '\n'){
+            saverPart("\n", 1, 0);
+        }
+    }
+    saverNode(node->right);
+}
+
+// Lines of the file buffer as they are in rows: without the '\r' before
+// their newline, and each with a newline
+static void saverRaw(const char *s, size_t len){
+    const char *end = s + len;
+    if(memchr(s, '\r', len) == NULL){
+        saverPiece(s, len);
+        if(end[-1] != '\n'){
+            saverPiece("\n", 1);
+        }
+        return;
+    }
+    while(s < end){
+        const char *nl = memchr(s, '\n', end - s);
+        const char *line_end = nl ? nl : end;
+        const char *cut = line_end;
+        while(cut > s && cut[-1] == '\r'){
+            cut--;
+        }
+        if(nl && cut == line_end){
+            saverPiece(s, nl + 1 - s);
+        } else {
+            saverPiece(s, cut - s);
+            saverPiece("\n", 1);
+        }
+        s = nl ? nl + 1 : end;
+    }
+}
+
+// Make a rename in the directory of `path` survive a crash
+static void saveSyncDir(const char *path){
+    char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : (size_t) (slash - path)) : strdup(".");
+    int fd = open(dir, O_RDONLY);
+    if(fd != -1){
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// Write the pieces, picking up after short writes. Returns 0 or an errno.
+static int saverWrite(int fd){
+    struct iovec *iov = SAVER.pieces;
+    int n = SAVER.npieces;
+    while(n > 0){
+        ssize_t written = writev(fd, iov, n < KILO_WRITE_IOV ? n : KILO_WRITE_IOV);
+        if(written == -1){
+            if(errno == EINTR) continue;
+            return errno;
+        }
+        while(n > 0 && (size_t) written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0){
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write the snapshot to a new file next to the target and rename it over,
+ * so the old file is either left alone or replaced whole
+ */
+static void *saverMain(void *arg){
+    (void) arg;
+    int err = 0;
+
+    int i;
+    for(i = 0; i < SAVER.nparts; i++){
+        struct saverPart *part = &SAVER.parts[i];
+        if(part->raw){
+            saverRaw(part->s, part->len);
+        } else {
+            saverPiece(part->s, part->len);
+        }
+    }
+    int fd = mkstemp(SAVER.tmp);
+    if(fd == -1){
+        err = errno;
+    } else {
+        err = saverWrite(fd);
+        if(!err && (fchmod(fd, SAVER.mode) == -1 || fsync(fd) == -1)){
+            err = errno;
+        }
+        if(close(fd) == -1 && !err){
+            err = errno;
+        }
+        if(!err && rename(SAVER.tmp, SAVER.target) == -1){
+            err = errno;
+        }
+        if(err){
+            unlink(SAVER.tmp);
+        } else {
+            saveSyncDir(SAVER.target);
+        }
+    }
+    SAVER.err = err;
+    write(CONFIG.signal_pipe[1], "S", 1);
+    return NULL;
+}
+
+static long filePageSize;
+
+/*
+ * Another process truncating the file makes the pages of the mapping past
+ * its new end fault in whichever thread reads them. Put zeroed pages there
+ * instead so the read goes on, and wake the event loop to say so.
+ */
+static void handleSigbus(int sig, siginfo_t *info, void *context){
+    (void) context;
+    char *addr = info->si_addr;
+    if(CONFIG.filemapped && addr >= CONFIG.filebuf && addr < &CONFIG.filebuf[CONFIG.filesize]){
+        int saved_errno = errno;
+        char *from = &CONFIG.filebuf[(addr - CONFIG.filebuf) & ~(filePageSize - 1)];
+        size_t len = &CONFIG.filebuf[CONFIG.filesize] - from;
+        if(mmap(from, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED){
+            CONFIG.file_changed = 1;
+            write(CONFIG.signal_pipe[1], "b", 1);
+            errno = saved_errno;
+            return;
+        }
+    }
+    // Not the file's fault, crash on the retry as there was no handler
+    signal(sig, SIG_DFL);
+}
+
+static void fileMapInit(){
+    static int done = 0;
+    if(done) return;
+    done = 1;
+
+    filePageSize = sysconf(_SC_PAGESIZE);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = handleSigbus;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    if(sigaction(SIGBUS, &sa, NULL) == -1){
+        die("sigaction");
+    }
+}
+
+/*
+ * The rows not edited yet still come from the file through the mapping, so
+ * tell the user once it changed on disk. Returns 1 if that is news.
+ */
+int editorFileCheck(){
+    if(!CONFIG.filemapped || CONFIG.file_changed == 2) return 0;
+    if(CONFIG.file_changed == 0){
+        struct stat st;
+        if(stat(CONFIG.filename, &st) == -1 || (st.st_size == CONFIG.filestat.st_size &&
+           st.st_mtim.tv_sec == CONFIG.filestat.st_mtim.tv_sec &&
+           st.st_mtim.tv_nsec == CONFIG.filestat.st_mtim.tv_nsec)){
+            return 0;
+        }
+    }
+    if(CONFIG.file_changed == 1){
+        editorSetStatusMessage("%s shrank on disk, the lines past its end read as zeros", CONFIG.filename);
+    } else {
+        editorSetStatusMessage("%s changed on disk, lines not edited may show the change", CONFIG.filename);
+    }
+    CONFIG.file_changed = 2;
+    return 1;
+}
+
+/*
+ * Replace the rows with the contents of a file, returns -1 if it can't be read
+ */
+int editorLoadFile(char* filename){
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+
+    if(fd == -1){
+        return -1;
+    }
+    if(fstat(fd, &st) == -1){
+        close(fd);
+        return -1;
+    }
+
+    // Map the file instead of reading it, rows are cut out of the mapping
+    // on demand so only the pages that are viewed or edited get touched.
+    // Writes to the file by others show through, see editorFileCheck().
+    size_t len = st.st_size;
+    char *buf = NULL;
+    int mapped = 0;
+    if(len > 0){
+        fileMapInit();
+        buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(buf != MAP_FAILED){
+            mapped = 1;
+        } else {
+            buf = malloc(len);
+            if(buf == NULL){
+                die("malloc");
+            }
+            size_t done = 0;
+            while(done < len){
+                ssize_t nread = read(fd, &buf[done], len - done);
+                if(nread == -1 && errno == EINTR) continue;
+                if(nread <= 0){
+                    free(buf);
+                    close(fd);
+                    return -1;
+                }
+                done += nread;
+            }
+        }
+    }
+    close(fd);
+
+    editorRowsLoad(buf, len, mapped);
+    CONFIG.filestat = st;
+    CONFIG.file_changed = 0;
+    CONFIG.dirty = 0;
+    return 0;
+}
+
+void editorOpen(char* filename){
+    free(CONFIG.filename);
+    CONFIG.filename = strdup(filename);
+
+    editorSelectSyntaxHighlight();
+
+    if(editorLoadFile(filename) == -1){
+        die("open");
+    }
+    editorJournalRecover();
+}
+
+/*
+ * Save in the background: take a snapshot of the rows and have a thread
+ * write it while editing goes on, editorSaveFinish() reports the result
+ */
+void editorSave(){
+    if(SAVER.running){
+        SAVER.again = 1;
+        return;
+    }
+    if(CONFIG.filename == NULL){
+        CONFIG.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if(CONFIG.filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    // The old inode lives on under the mapping once the new file is renamed
+    // over it, so the rows never have to be reloaded
+    SAVER.target = realpath(CONFIG.filename, NULL);
+    if(SAVER.target == NULL){
+        SAVER.target = strdup(CONFIG.filename);
+    }
+    size_t target_len = strlen(SAVER.target);
+    SAVER.tmp = malloc(target_len + 8);
+    if(SAVER.tmp == NULL){
+        die("malloc");
+    }
+    memcpy(SAVER.tmp, SAVER.target, target_len);
+    memcpy(&SAVER.tmp[target_len], ".XXXXXX", 8);
+
+    struct stat st;
+    if(stat(SAVER.target, &st) == 0){
+        SAVER.mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        SAVER.mode = 0644 & ~mask;
+    }
+
+    // Only rows that left the file buffer are copied, the rest of the
+    // snapshot points into it. What is not indexed yet is cut into lines by
+    // the thread, so taking the snapshot costs a walk of the tree nodes.
+    editorRowGapClose();
+    SAVER.nparts = 0;
+    SAVER.npieces = 0;
+    SAVER.bytes = 0;
+    saverNode(CONFIG.rows);
+    if(!editorRowsIndexed()){
+        saverPart(&CONFIG.filebuf[CONFIG.index_pos], CONFIG.filesize - CONFIG.index_pos, 1);
+    }
+    SAVER.dirty = CONFIG.dirty;
+    editorJournalMark();
+
+    if(pthread_create(&SAVER.thread, NULL, saverMain, NULL) != 0){
+        die("pthread_create");
+    }
+    SAVER.running = 1;
+    editorSetStatusMessage("Saving %s...", CONFIG.filename);
+}
+
+/*
+ * Wait for the background save, report how it went and drop its snapshot.
+ * Returns 0 if no save was running.
+ */
+int editorSaveFinish(){
+    if(!SAVER.running) return 0;
+    pthread_join(SAVER.thread, NULL);
+    SAVER.running = 0;
+
+    if(SAVER.err){
+        editorSetStatusMessage("Can't save! I/O errors: %s", strerror(SAVER.err));
+    } else {
+        // Edits made while saving are still unsaved
+        CONFIG.dirty -= SAVER.dirty;
+        editorJournalRebase(SAVER.target);
+        // The mapping keeps the old inode, only the new file is watched
+        stat(SAVER.target, &CONFIG.filestat);
+        editorSetStatusMessage("%zu bytes written to disk", SAVER.bytes);
+    }
+
+    int i;
+    for(i = 0; i < SAVER.nblocks; i++){
+        free(SAVER.blocks[i]);
+    }
+    SAVER.nblocks = 0;
+    free(SAVER.target);
+    free(SAVER.tmp);
+    SAVER.target = SAVER.tmp = NULL;
+
+    if(SAVER.again){
+        SAVER.again = 0;
+        editorSave();
+    }
+    return 1;
+}
+
+/*
+ * Let every save that was asked for finish
+ */
+void editorSaveWait(){
+    while(editorSaveFinish());
+}
+
+/*** journal ***/
+void editorJournalInit(){
+    JOURNAL.fd = -1;
+    JOURNAL.path = NULL;
+    JOURNAL.size = 0;
+    JOURNAL.header_len = 0;
+    JOURNAL.snapshot = -1;
+    JOURNAL.replaying = 0;
+    JOURNAL.disabled = 0;
+}
+
+// The journal of dir/name is dir/.name.journal
+static char *journalPath(const char *filename){
+    const char *slash = strrchr(filename, '/');
+    const char *base = slash ? slash + 1 : filename;
+    int dir_len = base - filename;
+    size_t len = dir_len + strlen(base) + sizeof("..journal");
+    char *path = malloc(len);
+    if(path == NULL){
+        die("malloc");
+    }
+    snprintf(path, len, "%.*s.%s.journal", dir_len, filename, base);
+    return path;
+}
+
+static void journalVarint(struct abuf *ab, unsigned long long v){
+    char buf[10];
+    int n = 0;
+    while(v >= 0x80){
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    abAppend(ab, buf, n);
+}
+
+// Read a varint at *p, returns -1 if it runs past end
+static int journalGet(const unsigned char **p, const unsigned char *end, long long *v){
+    unsigned long long value = 0;
+    int shift;
+    for(shift = 0; *p < end && shift < 63; shift += 7){
+        unsigned char byte = *(*p)++;
+        value |= (unsigned long long) (byte & 0x7f) << shift;
+        if(!(byte & 0x80)){
+            *v = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// The header ties the journal to the file it was written against
+static void journalHeader(struct abuf *ab, const char *filename){
+    struct stat st;
+    if(stat(filename, &st) == -1){
+        memset(&st, 0, sizeof(st));
+    }
+    abAppend(ab, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC));
+    journalVarint(ab, st.st_size);
+    journalVarint(ab, st.st_mtim.tv_sec);
+    journalVarint(ab, st.st_mtim.tv_nsec);
+}
+
+// Stop journaling for the rest of the session, a journal with a hole in it
+// would replay into the wrong text
+static void journalFail(const char *what){
+    editorSetStatusMessage("Journal %s failed: %s, edits are no longer journaled", what, strerror(errno));
+    editorJournalDiscard();
+    JOURNAL.disabled = 1;
+}
+
+// Write out the buffered records without waiting for the disk
+static int journalWrite(){
+    if(JOURNAL.fd == -1 || JOURNAL.pending.len == 0) return 0;
+    if(abFlush(&JOURNAL.pending, JOURNAL.fd) == -1){
+        journalFail("write");
+        return -1;
+    }
+    JOURNAL.size += JOURNAL.pending.len;
+    abReset(&JOURNAL.pending);
+    return 0;
+}
+
+/*
+ * Note an edit about to be made by the row operations. It reaches the disk
+ * with the next sync, at most KILO_JOURNAL_MS later.
+ */
+void editorJournalRecord(int op, int row, int at, const char *s, size_t len){
+    if(JOURNAL.replaying || JOURNAL.disabled || CONFIG.filename == NULL) return;
+    if(JOURNAL.fd == -1){
+        if(JOURNAL.path == NULL){
+            JOURNAL.path = journalPath(CONFIG.filename);
+        }
+        JOURNAL.fd = open(JOURNAL.path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+        if(JOURNAL.fd == -1){
+            journalFail("open");
+            return;
+        }
+        journalHeader(&JOURNAL.pending, CONFIG.filename);
+        JOURNAL.header_len = JOURNAL.pending.len;
+        JOURNAL.size = 0;
+    }
+
+    struct abuf *ab = &JOURNAL.pending;
+    char byte = op;
+    abAppend(ab, &byte, 1);
+    journalVarint(ab, row);
+    if(op == JOURNAL_INSERT_CHAR || op == JOURNAL_DEL_CHAR || op == JOURNAL_TRUNCATE){
+        journalVarint(ab, at);
+    }
+    if(op == JOURNAL_INSERT_ROW || op == JOURNAL_APPEND){
+        journalVarint(ab, len);
+    }
+    if(len > 0){
+        abAppend(ab, s, len);
+    }
+
+    if(ab->len >= KILO_JOURNAL_BUFFER){
+        journalWrite();
+    }
+    if(CONFIG.timers[TIMER_JOURNAL] == 0){
+        editorTimerSet(TIMER_JOURNAL, KILO_JOURNAL_MS);
+    }
+}
+
+/*
+ * Write out the buffered records and wait for them to be on disk. Edits
+ * that come quickly share one sync.
+ */
+void editorJournalSync(){
+    if(journalWrite() == -1 || JOURNAL.fd == -1) return;
+    if(fdatasync(JOURNAL.fd) == -1){
+        journalFail("sync");
+    }
+}
+
+/*
+ * A save is taking its snapshot: records from here on are not in it
+ */
+void editorJournalMark(){
+    journalWrite();
+    JOURNAL.snapshot = JOURNAL.fd == -1 ? -1 : JOURNAL.size;
+}
+
+/*
+ * The snapshot is on disk as `target`. Start a journal against it holding
+ * only the records made since the snapshot was taken.
+ */
+void editorJournalRebase(const char *target){
+    if(JOURNAL.fd == -1 || journalWrite() == -1) return;
+    off_t from = JOURNAL.snapshot == -1 ? JOURNAL.header_len : JOURNAL.snapshot;
+    size_t tail_len = JOURNAL.size - from;
+    if(tail_len == 0){
+        editorJournalDiscard();
+        return;
+    }
+
+    struct abuf out = ABUF_INIT;
+    journalHeader(&out, target);
+    off_t header_len = out.len;
+    char *tail = malloc(tail_len);
+    if(tail == NULL){
+        die("malloc");
+    }
+    size_t done = 0;
+    while(done < tail_len){
+        ssize_t n = pread(JOURNAL.fd, tail + done, tail_len - done, from + done);
+        if(n <= 0){
+            if(n == -1 && errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    abAppend(&out, tail, done);
+    free(tail);
+
+    size_t path_len = strlen(JOURNAL.path);
+    char *tmp = malloc(path_len + 5);
+    if(tmp == NULL){
+        die("malloc");
+    }
+    memcpy(tmp, JOURNAL.path, path_len);
+    memcpy(&tmp[path_len], ".new", 5);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if(done < tail_len || fd == -1 || abFlush(&out, fd) == -1 ||
+       fdatasync(fd) == -1 || rename(tmp, JOURNAL.path) == -1){
+        if(fd != -1){
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        abFree(&out);
+        journalFail("rebase");
+        return;
+    }
+    saveSyncDir(JOURNAL.path);
+    close(JOURNAL.fd);
+    JOURNAL.fd = fd;
+    JOURNAL.header_len = header_len;
+    JOURNAL.size = out.len;
+    free(tmp);
+    abFree(&out);
+}
+
+/*
+ * Replay a journal left behind by a session that didn't end cleanly, if it
+ * was written against the file as it is now
+ */
+void editorJournalRecover(){
+    free(JOURNAL.path);
+    JOURNAL.path = journalPath(CONFIG.filename);
+    int fd = open(JOURNAL.path, O_RDWR | O_APPEND);
+    if(fd == -1) return;
+
+    struct stat st;
+    unsigned char *buf = NULL;
+    ssize_t len = 0;
+    if(fstat(fd, &st) == -1){
+        st.st_size = -1;
+    } else if(st.st_size > 0){
+        buf = malloc(st.st_size);
+        if(buf == NULL){
+            die("malloc");
+        }
+        len = pread(fd, buf, st.st_size, 0);
+    }
+    if(st.st_size == -1 || len != st.st_size){
+        // The journal may be all that is left of the edits, it stays on
+        // disk and nothing more is written over it
+        editorSetStatusMessage("Can't read journal %s: %s, edits are not journaled",
+                               JOURNAL.path, len == -1 || st.st_size == -1 ? strerror(errno) : "short read");
+        JOURNAL.disabled = 1;
+        close(fd);
+        free(buf);
+        return;
+    }
+
+    struct abuf header = ABUF_INIT;
+    journalHeader(&header, CONFIG.filename);
+    if(len < header.len || memcmp(buf, header.buf, header.len) != 0){
+        close(fd);
+        unlink(JOURNAL.path);
+        editorSetStatusMessage("Discarded a journal written against another version of the file");
+        free(buf);
+        abFree(&header);
+        return;
+    }
+
+    // Apply records up to the first one that is torn or makes no sense
+    const unsigned char *p = buf + header.len;
+    const unsigned char *end = buf + len;
+    const unsigned char *good = p;
+    int count = 0;
+    JOURNAL.replaying = 1;
+    while(p < end){
+        int op = *p++;
+        long long row, at = 0, n = 0;
+        if(journalGet(&p, end, &row) == -1) break;
+        if(op == JOURNAL_INSERT_CHAR || op == JOURNAL_DEL_CHAR || op == JOURNAL_TRUNCATE){
+            if(journalGet(&p, end, &at) == -1) break;
+        }
+        if(op == JOURNAL_INSERT_ROW || op == JOURNAL_APPEND){
+            if(journalGet(&p, end, &n) == -1) break;
+        } else if(op == JOURNAL_INSERT_CHAR){
+            n = 1;
+        }
+        if(n > end - p) break;
+
+        // Rows are numbered from the top of the file, index as far as needed
+        editorRowsEnsure(row + 1);
+        if(op == JOURNAL_INSERT_ROW){
+            if(row > CONFIG.numrows) break;
+            editorInsertRow(row, (char *) p, n);
+        } else {
+            if(row >= CONFIG.numrows) break;
+            erow *r = editorRowAt(row);
+            if(op == JOURNAL_DEL_ROW){
+                editorDelRow(row);
+            } else if(op == JOURNAL_INSERT_CHAR && at <= r->size){
+                editorRowInsertChar(r, at, *p);
+            } else if(op == JOURNAL_DEL_CHAR && at < r->size){
+                editorRowDelChar(r, at);
+            } else if(op == JOURNAL_APPEND){
+                editorRowAppendString(r, (char *) p, n);
+            } else if(op == JOURNAL_TRUNCATE && at < r->size){
+                editorRowTruncate(r, at);
+            } else {
+                break;
+            }
+        }
+        p += n;
+        good = p;
+        count++;
+    }
+    JOURNAL.replaying = 0;
+
+    // The edits are still only in the journal, keep it going from the last
+    // good record
+    off_t size = good - buf;
+    if(count == 0 || ftruncate(fd, size) == -1){
+        close(fd);
+        unlink(JOURNAL.path);
+    } else {
+        JOURNAL.fd = fd;
+        JOURNAL.header_len = header.len;
+        JOURNAL.size = size;
+        editorSetStatusMessage("Recovered %d edits from the journal", count);
+    }
+    free(buf);
+    abFree(&header);
+}
+
+/*
+ * Drop the journal, its edits were saved or thrown away
+ */
+void editorJournalDiscard(){
+    if(JOURNAL.fd != -1){
+        close(JOURNAL.fd);
+        JOURNAL.fd = -1;
+        unlink(JOURNAL.path);
+    }
+    abReset(&JOURNAL.pending);
+    JOURNAL.size = 0;
+    JOURNAL.snapshot = -1;
+    CONFIG.timers[TIMER_JOURNAL] = 0;
+}
+
+/*** undo ***/
+void editorUndoInit(){
+    UNDO.log = (struct abuf) ABUF_INIT;
+    UNDO.pos = 0;
+    UNDO.open.op = 0;
+    UNDO.open.text = (struct abuf) ABUF_INIT;
+    UNDO.in_command = 0;
+    UNDO.run = 0;
+    UNDO.dropping = 0;
+    UNDO.applying = 0;
+}
+
+/*
+ * Forget every step, the rows they refer to are gone
+ */
+void editorUndoClear(){
+    abReset(&UNDO.log);
+    abReset(&UNDO.open.text);
+    UNDO.pos = 0;
+    UNDO.open.op = 0;
+    UNDO.run = 0;
+}
+
+/*
+ * A key is about to be handled. Keys that type or delete one byte at a
+ * time (`run`) carry on the step in progress, any other key ends it.
+ */
+void editorUndoCommand(int run){
+    UNDO.in_command = 0;
+    UNDO.dropping = 0;
+    if(!run){
+        UNDO.run = 0;
+    }
+}
+
+// Parse the record at `off` into r, text pointing into the log. Returns the
+// offset of the next record, or -1 if the record is cut short.
+static int undoParse(int off, struct undoRecord *r, const char **text, int *len){
+    if(off < 0 || off >= UNDO.log.len) return -1;
+    const unsigned char *p = (const unsigned char *) &UNDO.log.buf[off];
+    const unsigned char *end = (const unsigned char *) &UNDO.log.buf[UNDO.log.len];
+    long long row, at, n;
+    int byte = *p++;
+    if(journalGet(&p, end, &row) == -1 || journalGet(&p, end, &at) == -1 ||
+       journalGet(&p, end, &n) == -1 || n < 0 || n + (long long) sizeof(int) > end - p){
+        return -1;
+    }
+    r->op = byte & ~UNDO_STEP;
+    r->step = (byte & UNDO_STEP) != 0;
+    r->row = row;
+    r->at = at;
+    *text = (const char *) p;
+    *len = n;
+    return (const char *) p + n + sizeof(int) - UNDO.log.buf;
+}
+
+// Drop the oldest steps once the log outgrows KILO_UNDO_BYTES, down to half
+// of it so trimming is rare
+static void undoTrim(){
+    if(UNDO.log.len <= KILO_UNDO_BYTES) return;
+    int cut = UNDO.log.len;
+    int last = -1;
+    int off = 0;
+    while(off < UNDO.log.len){
+        struct undoRecord r;
+        const char *text;
+        int len;
+        int next = undoParse(off, &r, &text, &len);
+        if(next == -1) break;
+        if(r.step){
+            last = off;
+            if(UNDO.log.len - off <= KILO_UNDO_BYTES / 2) break;
+        }
+        off = next;
+    }
+    if(last != -1 && UNDO.log.len - last <= KILO_UNDO_BYTES){
+        cut = last;
+    }
+    if(cut == UNDO.log.len && UNDO.in_command){
+        // The step being recorded doesn't fit, the rest of it is dropped too
+        UNDO.dropping = 1;
+        UNDO.run = 0;
+    }
+    memmove(UNDO.log.buf, &UNDO.log.buf[cut], UNDO.log.len - cut);
+    UNDO.log.len -= cut;
+    UNDO.pos -= cut;
+}
+
+// Move the record being extended into the log
+static void undoClose(){
+    struct undoRecord *o = &UNDO.open;
+    if(o->op == 0) return;
+    int start = UNDO.log.len;
+    char byte = o->op | (o->step ? UNDO_STEP : 0);
+    abAppend(&UNDO.log, &byte, 1);
+    journalVarint(&UNDO.log, o->row);
+    journalVarint(&UNDO.log, o->at);
+    journalVarint(&UNDO.log, o->text.len);
+    abAppend(&UNDO.log, o->text.buf, o->text.len);
+    // The length goes last too, so the log can be walked back from the end
+    int len = UNDO.log.len - start + sizeof(int);
+    abAppend(&UNDO.log, (char *) &len, sizeof(len));
+    UNDO.pos = UNDO.log.len;
+    o->op = 0;
+    undoTrim();
+}
+
+/*
+ * Note an edit about to be made by the row operations, with the text it
+ * inserts or removes. A byte typed or deleted next to the last one joins
+ * its record, so a run of typing costs one record.
+ */
+void editorUndoRecord(int op, int row, int at, const char *s, size_t len){
+    if(UNDO.applying || UNDO.dropping) return;
+    struct undoRecord *o = &UNDO.open;
+    if(o->op == op && UNDO.run && o->row == row && len == 1){
+        if(op == UNDO_INSERT_TEXT && at == o->at + o->text.len){
+            abAppend(&o->text, s, 1);
+            return;
+        }
+        if(op == UNDO_DEL_TEXT && at == o->at){
+            abAppend(&o->text, s, 1);
+            return;
+        }
+        if(op == UNDO_DEL_TEXT && at + 1 == o->at){
+            abAppend(&o->text, s, 1);
+            memmove(&o->text.buf[1], o->text.buf, o->text.len - 1);
+            o->text.buf[0] = *s;
+            o->at = at;
+            return;
+        }
+    }
+
+    undoClose();
+    // A new edit ends what could be redone
+    UNDO.log.len = UNDO.pos;
+    o->op = op;
+    o->step = !UNDO.in_command;
+    o->row = row;
+    o->at = at;
+    abReset(&o->text);
+    if(len > 0){
+        abAppend(&o->text, s, len);
+    }
+    UNDO.in_command = 1;
+    UNDO.run = 1;
+}
+
+// Make an edit with the row operations
+static void undoApply(int op, int row, int at, const char *s, int len){
+    editorRowsEnsure(row + 1);
+    if(op == UNDO_INSERT_ROW){
+        editorInsertRow(row, (char *) s, len);
+    } else if(op == UNDO_DEL_ROW){
+        editorDelRow(row);
+    } else {
+        editorRowGapClose();
+        erow *r = editorRowAt(row);
+        int tail_len = op == UNDO_INSERT_TEXT ? r->size - at : r->size - at - len;
+        if(op == UNDO_INSERT_TEXT && len == 1 && tail_len > 0){
+            editorRowInsertChar(r, at, *s);
+        } else if(op == UNDO_DEL_TEXT && len == 1 && tail_len > 0){
+            editorRowDelChar(r, at);
+        } else {
+            // Cut the row at `at` and put it back together around the text
+            char *tail = malloc(tail_len + 1);
+            if(tail == NULL){
+                die("malloc");
+            }
+            memcpy(tail, &r->chars[r->size - tail_len], tail_len);
+            editorRowTruncate(r, at);
+            if(op == UNDO_INSERT_TEXT){
+                editorRowAppendString(r, (char *) s, len);
+            }
+            if(tail_len > 0){
+                editorRowAppendString(r, tail, tail_len);
+            }
+            free(tail);
+        }
+    }
+}
+
+// Put the cursor at the first place a step touched when undoing it, and
+// after the last when redoing it
+static void undoCursor(struct undoRecord *r, int len, int redo, int *cy, int *cx){
+    int y = r->row;
+    int x = 0;
+    if(r->op == UNDO_INSERT_TEXT || r->op == UNDO_DEL_TEXT){
+        x = redo && r->op == UNDO_INSERT_TEXT ? r->at + len : r->at;
+    }
+    int before = y < *cy || (y == *cy && x < *cx);
+    if(*cy == -1 || before != redo){
+        *cy = y;
+        *cx = x;
+    }
+}
+
+static void undoMove(int cy, int cx){
+    CONFIG.cy = cy < CONFIG.numrows ? cy : CONFIG.numrows;
+    CONFIG.cx = cy < CONFIG.numrows && cx <= editorRowAt(cy)->size ? cx : 0;
+}
+
+/*
+ * Take back the last step: apply the inverse of its records, newest first
+ */
+void editorUndo(){
+    undoClose();
+    if(UNDO.pos == 0){
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    int cy = -1;
+    int cx = 0;
+    UNDO.applying = 1;
+    while(UNDO.pos > 0){
+        int rec_len;
+        memcpy(&rec_len, &UNDO.log.buf[UNDO.pos - sizeof(rec_len)], sizeof(rec_len));
+        int off = UNDO.pos - rec_len;
+        struct undoRecord r;
+        const char *text;
+        int len;
+        if(undoParse(off, &r, &text, &len) == -1) break;
+        // Every op has its opposite next to it in enum undoOp
+        undoApply(r.op ^ 1, r.row, r.at, text, len);
+        undoCursor(&r, len, 0, &cy, &cx);
+        UNDO.pos = off;
+        if(r.step) break;
+    }
+    UNDO.applying = 0;
+    UNDO.run = 0;
+    undoMove(cy, cx);
+}
+
+/*
+ * Make the last step taken back again
+ */
+void editorRedo(){
+    undoClose();
+    if(UNDO.pos == UNDO.log.len){
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    int cy = -1;
+    int cx = 0;
+    UNDO.applying = 1;
+    do {
+        struct undoRecord r;
+        const char *text;
+        int len;
+        int next = undoParse(UNDO.pos, &r, &text, &len);
+        if(next == -1 || (r.step && cy != -1)) break;
+        undoApply(r.op, r.row, r.at, text, len);
+        undoCursor(&r, len, 1, &cy, &cx);
+        UNDO.pos = next;
+    } while(UNDO.pos < UNDO.log.len);
+    UNDO.applying = 0;
+    UNDO.run = 0;
+    undoMove(cy, cx);
+}
+
+/*** append buffer ***/
+// appendbuffer append
+void abAppend(struct abuf *ab, const char* string, int len) {
+    // ab = append buffer to add string to
+    // string = string to copy
+    // len = length
+
+    if(len <= 0) return;
+
+    // grow geometrically so a buffer that is reused stops reallocating
+    if(ab->len + len > ab->cap){
+        int cap = ab->cap ? ab->cap : 4096;
+        while(cap < ab->len + len){
+            cap *= 2;
+        }
+        char *new = realloc(ab->buf, cap);
+
+        // A frame with pieces missing would garble the terminal
+        if (new == NULL){
+            die("realloc");
+        }
+        ab->buf = new;
+        ab->cap = cap;
+    }
+
+    // copy string into buffer starting at end of buffer
+    memcpy(&ab->buf[ab->len], string, len);
+    ab->len += len;
+}
+
+// Empty the buffer but keep its memory for the next use
+void abReset(struct abuf *ab){
+    ab->len = 0;
+}
+
+/*
+ * Write the whole buffer to fd, retrying short writes. Returns -1 on error.
+ */
+int abFlush(struct abuf *ab, int fd){
+    int done = 0;
+    while(done < ab->len){
+        ssize_t n = write(fd, ab->buf + done, ab->len - done);
+        if(n == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// append buffer free
+void abFree(struct abuf *ab){
+    free(ab->buf);
+}
+
+
+/*** screen ***/
+static void screenLinesFree(struct screenLine *lines){
+    if(lines == NULL) return;
+    int y;
+    for(y = 0; y < CONFIG.screen_lines; y++){
+        free(lines[y].chars);
+        free(lines[y].attrs);
+    }
+    free(lines);
+}
+
+static struct screenLine *screenLinesNew(int count, int width){
+    struct screenLine *lines = calloc(count, sizeof(struct screenLine));
+    if(lines == NULL){
+        die("calloc");
+    }
+    int y;
+    for(y = 0; y < count; y++){
+        lines[y].chars = malloc(width * KILO_CELL_BYTES);
+        lines[y].attrs = malloc(width * KILO_CELL_BYTES);
+        if(lines[y].chars == NULL || lines[y].attrs == NULL){
+            die("malloc");
+        }
+    }
+    return lines;
+}
+
+/*
+ * Build the escape sequence for every attribute once, so drawing a frame
+ * never has to format one
+ */
+void editorScreenInit(){
+    int attr;
+    for(attr = 0; attr < 256; attr++){
+        int hl = attr & ~ATTR_INVERSE;
+        ATTR_ESCAPES[attr].len = snprintf(ATTR_ESCAPES[attr].seq, sizeof(ATTR_ESCAPES[attr].seq),
+                                          "\x1b[%d;%dm", (attr & ATTR_INVERSE) ? 7 : 27,
+                                          hl == HL_NORMAL ? 39 : editorSyntaxToColor(hl));
+    }
+}
+
+/*
+ * Size the frame buffers to the window: the text rows plus the status and
+ * message bars. The terminal contents are unknown after this.
+ */
+void editorScreenResize(){
+    screenLinesFree(CONFIG.screen);
+    screenLinesFree(CONFIG.next_frame);
+    CONFIG.screen_lines = CONFIG.screenrows + 2;
+    CONFIG.screen_width = CONFIG.screencols;
+    CONFIG.screen = screenLinesNew(CONFIG.screen_lines, CONFIG.screen_width);
+    CONFIG.next_frame = screenLinesNew(CONFIG.screen_lines, CONFIG.screen_width);
+    CONFIG.screen_valid = 0;
+}
+
+// Bytes of s that go on line, cut at the screen width in columns
+static int screenCut(struct screenLine *line, const char *s, int len, int *cols){
+    if(len > CONFIG.screen_width * KILO_CELL_BYTES - line->len){
+        len = CONFIG.screen_width * KILO_CELL_BYTES - line->len;
+    }
+    return utf8Fit(s, len, CONFIG.screen_width - line->cols, cols);
+}
+
+/*
+ * Add text to line y of the frame being drawn, cut at the screen width
+ */
+void editorScreenAppend(int y, const char *s, int len, unsigned char attr){
+    struct screenLine *line = &CONFIG.next_frame[y];
+    int cols;
+    len = screenCut(line, s, len, &cols);
+    if(len <= 0) return;
+
+    memcpy(&line->chars[line->len], s, len);
+    memset(&line->attrs[line->len], attr, len);
+    line->len += len;
+    line->cols += cols;
+}
+
+/*
+ * Same as editorScreenAppend, but with an attribute per byte
+ */
+void editorScreenAppendSpan(int y, const char *s, const unsigned char *attrs, int len){
+    struct screenLine *line = &CONFIG.next_frame[y];
+    int cols;
+    len = screenCut(line, s, len, &cols);
+    if(len <= 0) return;
+
+    memcpy(&line->chars[line->len], s, len);
+    memcpy(&line->attrs[line->len], attrs, len);
+    line->len += len;
+    line->cols += cols;
+}
+
+static void screenSetAttr(struct abuf *ab, int attr){
+    abAppend(ab, ATTR_ESCAPES[attr].seq, ATTR_ESCAPES[attr].len);
+}
+
+// Whether a character can start at byte `at` of a line: not inside a
+// UTF-8 sequence, and not a mark that draws onto the character before it
+static int screenCharBoundary(struct screenLine *line, int at){
+    if(at >= line->len) return 1;
+    unsigned char c = line->chars[at];
+    if(c < 0x80) return 1;
+    if((c & 0xc0) == 0x80) return 0;
+    int width;
+    editorCellWidth(&line->chars[at], line->len - at, &width);
+    return width != 0;
+}
+
+/*
+ * Compare the new frame against what the terminal shows and only write the
+ * part of each line that changed, then make the new frame current
+ */
+void editorScreenFlush(struct abuf *ab){
+    int attr = -1; // unknown until we set it
+    int y;
+
+    if(!CONFIG.screen_valid){
+        abAppend(ab, "\x1b[2J", 4);
+        for(y = 0; y < CONFIG.screen_lines; y++){
+            CONFIG.screen[y].len = 0;
+            CONFIG.screen[y].cols = 0;
+        }
+    }
+
+    for(y = 0; y < CONFIG.screen_lines; y++){
+        struct screenLine *old = &CONFIG.screen[y];
+        struct screenLine *new = &CONFIG.next_frame[y];
+        int common = old->len < new->len ? old->len : new->len;
+
+        int start = 0;
+        while(start < common && old->chars[start] == new->chars[start] &&
+              old->attrs[start] == new->attrs[start]){
+            start++;
+        }
+        if(start == common && old->len == new->len) continue;
+        // Changes are written from where a character starts in both lines
+        while(start > 0 && !(screenCharBoundary(new, start) && screenCharBoundary(old, start))){
+            start--;
+        }
+
+        // With the same bytes and columns, what is left of the end of the
+        // line is in the same columns too
+        int end = new->len;
+        if(old->len == new->len && old->cols == new->cols){
+            while(end > start && old->chars[end - 1] == new->chars[end - 1] &&
+                  old->attrs[end - 1] == new->attrs[end - 1]){
+                end--;
+            }
+            while(!screenCharBoundary(new, end)){
+                end++;
+            }
+        }
+
+        int col;
+        utf8Fit(new->chars, start, INT_MAX, &col);
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, col + 1);
+        abAppend(ab, buf, len);
+
+        // Write each run of equal attribute in one go
+        int j = start;
+        while(j < end){
+            int run = j + 1;
+            while(run < end && new->attrs[run] == new->attrs[j]){
+                run++;
+            }
+            if(new->attrs[j] != attr){
+                attr = new->attrs[j];
+                screenSetAttr(ab, attr);
+            }
+            abAppend(ab, &new->chars[j], run - j);
+            j = run;
+        }
+        if(new->cols < old->cols){
+            // Erase the rest with plain colours, K paints the background
+            if(attr != HL_NORMAL){
+                attr = HL_NORMAL;
+                screenSetAttr(ab, attr);
+            }
+            abAppend(ab, "\x1b[K", 3);
+        }
+    }
+    if(attr != -1 && attr != HL_NORMAL){
+        abAppend(ab, "\x1b[m", 3);
+    }
+
+    struct screenLine *swap = CONFIG.screen;
+    CONFIG.screen = CONFIG.next_frame;
+    CONFIG.next_frame = swap;
+    CONFIG.screen_valid = 1;
+}
+
+/*** output ***/
+void editorDrawRows(){
+    int y;
+    for(y = 0; y < CONFIG.screenrows; y++){
+        int filerow = y + CONFIG.rowoff;
+        if (filerow >= CONFIG.numrows) {
+            // Put welcome message in top third of screen
+            if(CONFIG.numrows ==0 && y== CONFIG.screenrows / 3) {
+                // But only If text buffer is empty
+                char welcome[80];
+                int welcomelen = snprintf(welcome, sizeof(welcome), "Kilo editor -- version %s", KILO_VERSION);
+
+                // /* TODO:  *truncate message if screen too short
+                if(welcomelen > CONFIG.screencols) {
+                    welcomelen = CONFIG.screencols;
+                }
+
+                int padding = (CONFIG.screencols - welcomelen) / 2;
+                if (padding) {
+                    editorScreenAppend(y, "~", 1, HL_NORMAL);
+                    padding--;
+                }
+                while (padding--) {
+                    editorScreenAppend(y, " ", 1, HL_NORMAL);
+                }
+                editorScreenAppend(y, welcome, welcomelen, HL_NORMAL);
+            } else {
+                editorScreenAppend(y, "~", 1, HL_NORMAL);
+            }
+        } else {
+            erow *file_row = editorRowAt(filerow);
+            editorRowRender(file_row);
+            if(file_row->render_flags & ROW_HAS_HIGH){
+                editorDrawRowCells(y, file_row);
+                continue;
+            }
+            int len = file_row->rsize - CONFIG.coloff; //Handle multiple rows
+            // because len can now be negative, need to be sure its min is 0
+            if(len < 0){
+                len = 0;
             }
 
             if(len > CONFIG.screencols){
                 len = CONFIG.screencols;
             }
             
-            char* row = &CONFIG.row[filerow].render[CONFIG.coloff];
-            unsigned char* hl = &CONFIG.row[filerow].hl[CONFIG.coloff];
-            int current_color = -1;
+            char* row = &file_row->render[CONFIG.coloff];
+            unsigned char* hl = &file_row->hl[CONFIG.coloff];
+            // Rows without control bytes need no per byte check
+            int has_ctrl = file_row->render_flags & ROW_HAS_CTRL;
             
-            int j;
-            for(j=0; j < len; j++) {
-                if(iscntrl(row[j])) {
-                    char sym = (row[j] <= 26) ? '@' + row[j] : '?';
-                    abAppend(ab, "\x1b[7m]", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m]", 3);
-
-                    if(current_color != -1){
-                        char buf[16];
-                        int clen = snprinf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
-                } else if(row[j] == HL_NORMAL) {
-                    if(current_color != -1){
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(ab, &row[j], 1);
-                } else {
-                    int color = editorSyntaxToColor(hl[j]);
+            if(!has_ctrl){
+                // at filerow print as many characters, starting at offset as there is screensize or chars left
+                editorScreenAppendSpan(y, row, hl, len);
+                continue;
+            }
+            int j = 0;
+            while(j < len){
+                int run = j;
+                while(run < len && !iscntrl((unsigned char) row[run])){
+                    run++;
+                }
+                editorScreenAppendSpan(y, &row[j], &hl[j], run - j);
+                if(run < len){
+                    char sym = (row[run] <= 26) ? '@' + row[run] : '?';
+                    editorScreenAppend(y, &sym, 1, ATTR_INVERSE | HL_NORMAL);
+                    run++;
+                }
+                j = run;
+            }
+        }
+    }
+}
+
+/*
+ * Draw a row holding UTF-8 cell by cell. The first cell is found through
+ * the checkpoints, a wide character cut by either edge of the screen shows
+ * as spaces for the columns of it that are on screen.
+ */
+void editorDrawRowCells(int y, erow *file_row){
+    int j = rowConvert(file_row, 1, 2, CONFIG.coloff);
+    int col = rowConvert(file_row, 2, 1, j);
+    int end = CONFIG.coloff + CONFIG.screencols;
+    const char *row = file_row->render;
+    const unsigned char *hl = file_row->hl;
+
+    while(j < file_row->rsize && col < end){
+        unsigned char c = row[j];
+        if(c >= 0x20 && c < 0x7f){
+            // Printable ASCII in one go
+            int run = j + 1;
+            while(run < file_row->rsize && run - j < end - col &&
+                  row[run] >= 0x20 && row[run] < 0x7f){
+                run++;
+            }
+            editorScreenAppendSpan(y, &row[j], &hl[j], run - j);
+            col += run - j;
+            j = run;
+            continue;
+        }
+
+        unsigned int cp = 0;
+        int len = c < 0x80 ? 1 : editorUtf8Decode(&row[j], file_row->rsize - j, &cp);
+        if(c < 0x80 || len == 0 || cp < 0xa0){
+            // Controls, C1 controls and bytes that don't decode
+            char sym = (c <= 26) ? '@' + c : '?';
+            editorScreenAppend(y, &sym, 1, ATTR_INVERSE | HL_NORMAL);
+            col++;
+            j += len ? len : 1;
+            continue;
+        }
+
+        int width = editorCharWidth(cp);
+        if(col < CONFIG.coloff || col + width > end){
+            int from = col < CONFIG.coloff ? CONFIG.coloff : col;
+            int to = col + width > end ? end : col + width;
+            for(; from < to; from++){
+                editorScreenAppend(y, " ", 1, hl[j]);
+            }
+        } else if(width || CONFIG.next_frame[y].cols){
+            // A mark only goes on screen after the character it is on
+            editorScreenAppendSpan(y, &row[j], &hl[j], len);
+        }
+        col += width;
+        j += len;
+    }
+}
+
+void editorDrawStatusBar() {
+  int y = CONFIG.screenrows;
+  char status[80], rstatus[80];
+  int len = snprintf(status, sizeof(status), "%.20s - %d%s lines %s",
+    CONFIG.filename ? CONFIG.filename : "[No Name]", CONFIG.numrows,
+    editorRowsIndexed() ? "" : "+", CONFIG.dirty ? "(modified)" : "");
+  char found[40] = "";
+  if (SEARCH.query) {
+    // Matches so far, and how much of the buffer the scan has been through.
+    // The workers add to both under the lock.
+    pthread_mutex_lock(&SEARCH.lock);
+    long count = SEARCH.count;
+    size_t bytes_done = SEARCH.bytes_done;
+    pthread_mutex_unlock(&SEARCH.lock);
+    if (editorSearchDone()) {
+      snprintf(found, sizeof(found), "%ld matches | ", count);
+    } else {
+      snprintf(found, sizeof(found), "%ld matches %d%% | ", count,
+        (int) (bytes_done * 100 / (SEARCH.bytes ? SEARCH.bytes : 1)));
+    }
+  }
+  int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | line %d of %d%s, byte %zu", found,
+    CONFIG.syntax ? CONFIG.syntax->filetype : "no ft", CONFIG.cy + 1, CONFIG.numrows,
+    editorRowsIndexed() ? "" : "+", editorRowOffset(CONFIG.cy) + CONFIG.cx);
+  // snprintf() reports what would have fit, not what did
+  if (len > (int) sizeof(status) - 1) len = sizeof(status) - 1;
+  if (rlen > (int) sizeof(rstatus) - 1) rlen = sizeof(rstatus) - 1;
+  editorScreenAppend(y, status, len, ATTR_INVERSE | HL_NORMAL);
+  // The file name can be UTF-8, pad by the columns it took
+  len = CONFIG.next_frame[y].cols;
+  while (len < CONFIG.screencols) {
+    if (CONFIG.screencols - len == rlen) {
+      editorScreenAppend(y, rstatus, rlen, ATTR_INVERSE | HL_NORMAL);
+      break;
+    } else {
+      editorScreenAppend(y, " ", 1, ATTR_INVERSE | HL_NORMAL);
+      len++;
+    }
+  }
+}
+void editorRefreshScreen(){
+    editorScroll();
+    if(CONFIG.screen_lines != CONFIG.screenrows + 2 || CONFIG.screen_width != CONFIG.screencols){
+        editorScreenResize();
+    }
+
+    int y;
+    for(y = 0; y < CONFIG.screen_lines; y++){
+        CONFIG.next_frame[y].len = 0;
+        CONFIG.next_frame[y].cols = 0;
+    }
+    editorDrawRows();
+    editorDrawStatusBar();
+    editorDrawMessageBar();
+
+    int cx = (CONFIG.rx - CONFIG.coloff) + 1;
+    int cy = (CONFIG.cy - CONFIG.rowoff) + 1;
+
+    struct abuf *ab = &FRAME_OUT;
+    abReset(ab);
+
+    // l = turn off
+    // ?25 = cursor
+    abAppend(ab, "\x1b[?25l", 6);
+    int header = ab->len;
+    editorScreenFlush(ab);
+
+    if(ab->len == header && cx == CONFIG.screen_cx && cy == CONFIG.screen_cy){
+        // Nothing changed, don't write anything at all
+        abReset(ab);
+    } else {
+        char buf[32];
+        // Specify the exact position in the terminal the cursor should be drawn atexit
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy, cx);
+        abAppend(ab, buf, len);
+
+        // h = turn on
+        // ?25 = cursor
+        abAppend(ab, "\x1b[?25h", 6);
+        abFlush(ab, STDOUT_FILENO);
+    }
+    CONFIG.screen_cx = cx;
+    CONFIG.screen_cy = cy;
+    CONFIG.frame_bytes = ab->len;
+    CONFIG.total_bytes += ab->len;
+    CONFIG.frame++;
+    if(REPLAY.active){
+        editorReplayFrame();
+    }
+}
+
+void editorScroll() {
+    CONFIG.rx = 0;
+    editorRowsEnsure(CONFIG.cy + 1);
+
+    if(CONFIG.cy < CONFIG.numrows) {
+        CONFIG.rx = editorRowCxToRx(editorRowAt(CONFIG.cy), CONFIG.cx);// Ensure cursor moves properly with tabs
+    }
+
+    if (CONFIG.cy < CONFIG.rowoff) {
+        CONFIG.rowoff = CONFIG.cy;
+    }
+    if (CONFIG.cy >= CONFIG.rowoff + CONFIG.screenrows) {
+        CONFIG.rowoff = CONFIG.cy - CONFIG.screenrows + 1;
+    }
+    // coloff is in columns like rx, not in bytes like cx
+    if(CONFIG.rx  < CONFIG.coloff){
+        CONFIG.coloff = CONFIG.rx;
+    }
+    if(CONFIG.rx >= CONFIG.coloff + CONFIG.screencols){
+        CONFIG.coloff = CONFIG.rx - CONFIG.screencols + 1;
+    }
+    editorRowsEnsure(CONFIG.rowoff + CONFIG.screenrows);
+    editorSyntaxAvailable(CONFIG.rowoff + CONFIG.screenrows);
+}
+
+void editorSetStatusMessage(const char* fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(CONFIG.statusmsg, sizeof(CONFIG.statusmsg), fmt, ap);
+    va_end(ap);
+    editorTimerSet(TIMER_STATUS, KILO_STATUS_MS);
+}
+
+void editorDrawMessageBar(){
+    int y = CONFIG.screenrows + 1;
+    int msglen = strlen(CONFIG.statusmsg);
+    if(msglen && editorTimerPending(TIMER_STATUS)){
+        editorScreenAppend(y, CONFIG.statusmsg, msglen, HL_NORMAL);
+    } else if(CONFIG.show_stats){
+        char stats[160];
+        int statslen = editorDrawStats(stats, sizeof(stats));
+        editorScreenAppend(y, stats, statslen, HL_NORMAL);
+    }
+
+}
+
+/*
+ * Performance counters shown in the message bar, toggled with Ctrl-T
+ */
+int editorDrawStats(char *buf, int size){
+    int len = snprintf(buf, size, "frame %zuB total %lluK | cache %zuK/%zuK hit %lu miss %lu evict %lu | rows %zuK/%zuK",
+                       CONFIG.frame_bytes, CONFIG.total_bytes >> 10,
+                       CONFIG.cache_bytes >> 10, CONFIG.cache_budget >> 10,
+                       CONFIG.cache_hits, CONFIG.cache_misses, CONFIG.cache_evictions,
+                       CONFIG.mem_used >> 10, CONFIG.mem_reserved >> 10);
+    return len < size ? len : size - 1;
+}
+
+
+/*** input ***/
+/*
+ * Background work done while waiting for input. Returns 1 if the screen
+ * needs to be redrawn.
+ */
+int editorIdle(){
+    if(editorRowsIndexed()) return 0;
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        editorRowsIndexMore(KILO_INDEX_CHUNK);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while(!editorRowsIndexed() &&
+            (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < KILO_INDEX_IDLE_MS);
+    return 1;
+}
+
+/*
+ * Read the rest of a bracketed paste, up to its end marker, and insert it
+ * all at once. If the input ends first, what came of the paste is inserted.
+ */
+void editorPaste(){
+    static const char end[] = "\x1b[201~";
+    int end_len = sizeof(end) - 1;
+    struct abuf paste = ABUF_INIT;
+    int ended = 0;
+
+    while(!ended){
+        if(CONFIG.input_pos == CONFIG.input_len){
+            ended = inputFill(-1) == -1;
+            continue;
+        }
+        char *start = &CONFIG.input[CONFIG.input_pos];
+        int avail = CONFIG.input_len - CONFIG.input_pos;
+        char *esc = memchr(start, '\x1b', avail);
+        if(esc == NULL){
+            abAppend(&paste, start, avail);
+            CONFIG.input_pos = CONFIG.input_len;
+            continue;
+        }
+        abAppend(&paste, start, esc - start);
+        CONFIG.input_pos += esc - start;
+
+        // Only a whole end marker ends the paste
+        while(!ended && CONFIG.input_len - CONFIG.input_pos < end_len){
+            ended = inputFill(-1) == -1;
+        }
+        if(ended){
+            abAppend(&paste, &CONFIG.input[CONFIG.input_pos], CONFIG.input_len - CONFIG.input_pos);
+            CONFIG.input_pos = CONFIG.input_len;
+            break;
+        }
+        if(!memcmp(&CONFIG.input[CONFIG.input_pos], end, end_len)){
+            CONFIG.input_pos += end_len;
+            break;
+        }
+        abAppend(&paste, "\x1b", 1);
+        CONFIG.input_pos++;
+    }
+
+    editorInsertText(paste.buf ? paste.buf : "", paste.len);
+    abFree(&paste);
+}
+
+void editorMoveCursor(int key){
+    // The row below the cursor has to exist before we can move onto it
+    editorRowsEnsure(CONFIG.cy + 2);
+    erow *row = (CONFIG.cy >= CONFIG.numrows) ? NULL : editorRowAt(CONFIG.cy);
+
+    switch(key) {
+
+    case ARROW_LEFT:
+        if (CONFIG.cx != 0){
+            CONFIG.cx = rowCharPrev(row, CONFIG.cx);
+        } else if (CONFIG.cy > 0){ // Go one row up and to the end of the line
+            CONFIG.cy--;
+            CONFIG.cx = editorRowAt(CONFIG.cy)->size;
+        }
+        break;
+    case ARROW_RIGHT:
+        if(row && CONFIG.cx < row->size){
+            CONFIG.cx = rowCharNext(row, CONFIG.cx);
+        } else if(row && CONFIG.cx == row->size){
+            CONFIG.cy++;
+            CONFIG.cx = 0;
+        }
+        break;
+    case ARROW_UP:
+        if(CONFIG.cy > 0){
+            CONFIG.cy--;
+        }
+        break;
+    case ARROW_DOWN:
+        if(CONFIG.cy < CONFIG.numrows){
+            CONFIG.cy++;
+        }
+        break;
+    }
+
+    row = (CONFIG.cy >= CONFIG.numrows) ? NULL : editorRowAt(CONFIG.cy);
+
+    int rowlen = row ? row->size : 0;
+    if(CONFIG.cx > rowlen){
+        CONFIG.cx = rowlen;
+    } else if(CONFIG.cx < rowlen){
+        // Up or down can land inside a character of the new row
+        CONFIG.cx = rowCharStart(row, CONFIG.cx);
+    }
+}
+
+/*** search ***/
+void editorMatcherInit(struct editorMatcher *m, const char *query){
+    m->query = query;
+    m->len = strlen(query);
+    int i;
+    for(i = 0; i < 256; i++){
+        m->skip[i] = m->len;
+    }
+    for(i = 0; i < m->len - 1; i++){
+        m->skip[(unsigned char) query[i]] = m->len - 1 - i;
+    }
+}
+
+// Horspool over s[0..len), for what the vector loop leaves over
+static const char *matchFirstScalar(struct editorMatcher *m, const char *s, size_t len){
+    size_t last = m->len - 1;
+    size_t i = 0;
+    while(i + m->len <= len){
+        unsigned char c = s[i + last];
+        if(c == (unsigned char) m->query[last] && !memcmp(&s[i], m->query, last)){
+            return &s[i];
+        }
+        i += m->skip[c];
+    }
+    return NULL;
+}
+
+/*
+ * First match of the query in s[0..len), NULL if there is none
+ */
+const char *editorMatchFirst(struct editorMatcher *m, const char *s, size_t len){
+    if(m->len == 0) return s;
+    if((size_t) m->len > len) return NULL;
+    if(m->len == 1) return memchr(s, m->query[0], len);
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Compare the first and the last query byte at 16 positions at once,
+    // only positions where both agree are checked in full
+    const __m128i first = _mm_set1_epi8(m->query[0]);
+    const __m128i last = _mm_set1_epi8(m->query[m->len - 1]);
+    for(; i + m->len - 1 + 16 <= len; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i *) &s[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &s[i + m->len - 1]);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                            _mm_cmpeq_epi8(b, last)));
+        while(mask){
+            int bit = __builtin_ctz(mask);
+            if(!memcmp(&s[i + bit + 1], m->query + 1, m->len - 2)){
+                return &s[i + bit];
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return matchFirstScalar(m, s + i, len - i);
+}
+
+/*
+ * Last match of the query in s[0..len), NULL if there is none
+ */
+const char *editorMatchLast(struct editorMatcher *m, const char *s, size_t len){
+    if(m->len == 0) return s + len;
+    if((size_t) m->len > len) return NULL;
+
+    // Positions that can start a match are 0..end-1
+    size_t end = len - m->len + 1;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(m->query[0]);
+    const __m128i last = _mm_set1_epi8(m->query[m->len - 1]);
+    while(end >= 16){
+        size_t i = end - 16;
+        __m128i a = _mm_loadu_si128((const __m128i *) &s[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &s[i + m->len - 1]);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                            _mm_cmpeq_epi8(b, last)));
+        while(mask){
+            int bit = 31 - __builtin_clz(mask);
+            if(!memcmp(&s[i + bit], m->query, m->len)){
+                return &s[i + bit];
+            }
+            mask &= ~(1u << bit);
+        }
+        end = i;
+    }
+#endif
+    while(end > 0){
+        end--;
+        if(s[end] == m->query[0] && !memcmp(&s[end], m->query, m->len)){
+            return &s[end];
+        }
+    }
+    return NULL;
+}
+
+// Where the text of `line` and everything after it in the file buffer
+// ends. The last line has no terminator in the buffer when the file does
+// not end in a newline.
+static size_t searchLineEnd(int line){
+    size_t end = CONFIG.line_start[line + 1] - 1;
+    return end < CONFIG.filesize ? end : CONFIG.filesize;
+}
+
+// Line of the span node holding the byte at `match`
+static int searchSpanLine(rownode *node, const char *match){
+    size_t pos = match - CONFIG.filebuf;
+    int lo = node->first_line;
+    int hi = node->first_line + node->nlines - 1;
+    while(lo < hi){
+        int mid = lo + (hi - lo + 1) / 2;
+        if(CONFIG.line_start[mid] <= pos){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/*
+ * First row in [from, to) with a match, -1 if none. *cx is set to where
+ * the first match in that row starts. Spans of the file nobody edited are
+ * searched as one block of memory rather than row by row; queries never
+ * hold a newline or \r, so a match cannot run from one line into the next.
+ */
+int editorSearchForward(struct editorMatcher *m, int from, int to, int *cx){
+    if(from >= to) return -1;
+    if(m->len == 0){
+        *cx = 0;
+        return from;
+    }
+
+    int offset;
+    rownode *node = editorRowNodeAt(from, &offset);
+    int at = from - offset; // row the node starts at
+
+    while(node && at < to){
+        if(node->first_line == -1){
+            const char *match = editorMatchFirst(m, node->row.chars, node->row.size);
+            if(match){
+                *cx = match - node->row.chars;
+                return at;
+            }
+        } else {
+            int last = node->first_line + node->nlines - 1;
+            size_t start = CONFIG.line_start[node->first_line + offset];
+            const char *match = editorMatchFirst(m, &CONFIG.filebuf[start],
+                                                 searchLineEnd(last) - start);
+            if(match){
+                int line = searchSpanLine(node, match);
+                int row = at + line - node->first_line;
+                if(row >= to) return -1;
+                *cx = match - &CONFIG.filebuf[CONFIG.line_start[line]];
+                return row;
+            }
+        }
+        at += node->nlines;
+        offset = 0;
+        node = editorRowNodeNext(node);
+    }
+    return -1;
+}
+
+/*
+ * Last row in [from, to) with a match, -1 if none. *cx is set to where the
+ * first match in that row starts.
+ */
+int editorSearchBackward(struct editorMatcher *m, int from, int to, int *cx){
+    if(from >= to) return -1;
+    if(m->len == 0){
+        *cx = 0;
+        return to - 1;
+    }
 
-                    if(color != current_color){
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    // at filerow print as many characters, starting at offset as there is screensize or chars left
-                    abAppend(ab, &row[j], 1);
-                }
+    int offset;
+    rownode *node = editorRowNodeAt(to - 1, &offset);
+    int at = to - 1 - offset;
+
+    while(node && at + node->nlines > from){
+        int row = -1;
+        if(node->first_line == -1){
+            if(editorMatchFirst(m, node->row.chars, node->row.size)){
+                row = at;
+            }
+        } else {
+            // From row `from` or the top of the span to the end of row
+            // `at + offset`
+            int skip = at < from ? from - at : 0;
+            size_t start = CONFIG.line_start[node->first_line + skip];
+            size_t end = searchLineEnd(node->first_line + offset);
+            const char *match = editorMatchLast(m, &CONFIG.filebuf[start], end - start);
+            if(match){
+                row = at + searchSpanLine(node, match) - node->first_line;
             }
-            abAppend(ab, "\x1b[39m", 5);
         }
-        // K erases part of current line
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
+        if(row != -1){
+            // The cursor goes to the first match of the row
+            return editorSearchForward(m, row, row + 1, cx);
+        }
+        node = editorRowNodePrev(node);
+        if(node){
+            at -= node->nlines;
+            offset = node->nlines - 1;
+        }
     }
+    return -1;
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
-  abAppend(ab, "\x1b[7m", 4);
-  char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-    CONFIG.filename ? CONFIG.filename : "[No Name]", CONFIG.numrows,
-    CONFIG.dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
-    CONFIG.syntax ? CONFIG.syntax->filetype : "no ft", CONFIG.cy + 1, CONFIG.numrows);
-  if (len > CONFIG.screencols) len = CONFIG.screencols;
-  abAppend(ab, status, len);
-  while (len < CONFIG.screencols) {
-    if (CONFIG.screencols - len == rlen) {
-      abAppend(ab, rstatus, rlen);
-      break;
-    } else {
-      abAppend(ab, " ", 1);
-      len++;
+void editorSearchInit(){
+    memset(&SEARCH, 0, sizeof(SEARCH));
+    pthread_mutex_init(&SEARCH.lock, NULL);
+    pthread_cond_init(&SEARCH.work, NULL);
+    pthread_cond_init(&SEARCH.finished, NULL);
+    SEARCH.last_match = -1;
+    SEARCH.direction = 1;
+    SEARCH.hl_row = -1;
+}
+
+static void searchAddMatch(struct searchShard *shard, int row, int cx){
+    if(shard->nmatches == shard->match_cap){
+        shard->match_cap = shard->match_cap ? shard->match_cap * 2 : 64;
+        shard->matches = realloc(shard->matches, sizeof(struct searchMatch) * shard->match_cap);
+        if(shard->matches == NULL){
+            die("realloc");
+        }
     }
-  }
-  abAppend(ab, "\x1b[m", 3);
-  abAppend(ab, "\r\n", 2);
+    shard->matches[shard->nmatches].row = row;
+    shard->matches[shard->nmatches].cx = cx;
+    shard->nmatches++;
 }
-void editorRefreshScreen(){
-    editorScroll();
-    struct abuf ab = ABUF_INIT;
 
-    // l = turn off
-    // ?25 = cursor
-    abAppend(&ab, "\x1b[?25l", 6);
+// Find every match in a shard, runs on a worker thread
+static void searchShardRun(struct searchShard *shard){
+    struct editorMatcher *m = &SEARCH.matcher;
+    if(shard->first_line == -1){
+        int i;
+        for(i = 0; i < shard->nrows; i++){
+            struct searchText *text = &SEARCH.texts[shard->text + i];
+            const char *s = text->chars;
+            size_t len = text->size;
+            const char *match = editorMatchFirst(m, s, len);
+            if(match == NULL) continue;
+            searchAddMatch(shard, text->row, match - s);
+            do {
+                shard->count++;
+                size_t pos = match - s + m->len;
+                match = editorMatchFirst(m, s + pos, len - pos);
+            } while(match);
+        }
+        return;
+    }
+
+    // One pass over the span, lines are found by walking line_start along
+    // with the matches
+    int line = shard->first_line;
+    int last_row = -1;
+    size_t pos = CONFIG.line_start[line];
+    size_t end = searchLineEnd(shard->first_line + shard->nrows - 1);
+    const char *match;
+    while((match = editorMatchFirst(m, &CONFIG.filebuf[pos], end - pos))){
+        size_t at = match - CONFIG.filebuf;
+        while(CONFIG.line_start[line + 1] <= at){
+            line++;
+        }
+        int row = shard->row + line - shard->first_line;
+        if(row != last_row){
+            searchAddMatch(shard, row, at - CONFIG.line_start[line]);
+            last_row = row;
+        }
+        shard->count++;
+        pos = at + m->len;
+    }
+}
 
-    // Write four bytes to terminal
-    // \x1b = escape character (27)
-    // [J = erase screeen
-    // [J2 = clear entire screen
-    abAppend(&ab, "\x1b[H", 3);
+static void *searchWorker(void *arg){
+    (void) arg;
+    pthread_mutex_lock(&SEARCH.lock);
+    while(1){
+        while(SEARCH.next_shard >= SEARCH.ready){
+            pthread_cond_wait(&SEARCH.work, &SEARCH.lock);
+        }
+        struct searchShard *shard = &SEARCH.shards[SEARCH.next_shard++];
+        SEARCH.busy++;
+        pthread_mutex_unlock(&SEARCH.lock);
+
+        searchShardRun(shard);
+
+        pthread_mutex_lock(&SEARCH.lock);
+        shard->done = 1;
+        SEARCH.done++;
+        SEARCH.count += shard->count;
+        SEARCH.bytes_done += shard->bytes;
+        SEARCH.busy--;
+        pthread_cond_broadcast(&SEARCH.finished);
+        write(CONFIG.signal_pipe[1], "s", 1);
+    }
+    return NULL;
+}
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
-    char buf[32];
-    // Specify the exact position in the terminal the cursor should be drawn atexit
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (CONFIG.cy - CONFIG.rowoff) + 1, (CONFIG.rx - CONFIG.coloff) + 1);
-    abAppend(&ab, buf, strlen(buf));
+static struct searchShard *searchShardNew(int row, int first_line){
+    if(SEARCH.nshards == SEARCH.shard_cap){
+        SEARCH.shard_cap = SEARCH.shard_cap ? SEARCH.shard_cap * 2 : 64;
+        SEARCH.shards = realloc(SEARCH.shards, sizeof(struct searchShard) * SEARCH.shard_cap);
+        if(SEARCH.shards == NULL){
+            die("realloc");
+        }
+    }
+    struct searchShard *shard = &SEARCH.shards[SEARCH.nshards++];
+    memset(shard, 0, sizeof(*shard));
+    shard->row = row;
+    shard->first_line = first_line;
+    shard->text = SEARCH.ntexts;
+    return shard;
+}
 
-    // h = turn on
-    // ?25 = cursor
-    abAppend(&ab, "\x1b[?25h]", 6);
-    write(STDOUT_FILENO, ab.buf, ab.len);
-    abFree(&ab);
+// Add a row to the shard of texts being filled, starting a new one once it
+// holds KILO_SEARCH_SHARD bytes. Returns the shard to add the next row to.
+static struct searchShard *searchAddText(struct searchShard *open, int row, const char *chars, int size){
+    if(SEARCH.ntexts == SEARCH.text_cap){
+        SEARCH.text_cap = SEARCH.text_cap ? SEARCH.text_cap * 2 : 256;
+        SEARCH.texts = realloc(SEARCH.texts, sizeof(struct searchText) * SEARCH.text_cap);
+        if(SEARCH.texts == NULL){
+            die("realloc");
+        }
+    }
+    if(open == NULL){
+        open = searchShardNew(row, -1);
+    }
+    SEARCH.texts[SEARCH.ntexts].chars = chars;
+    SEARCH.texts[SEARCH.ntexts].size = size;
+    SEARCH.texts[SEARCH.ntexts].row = row;
+    SEARCH.ntexts++;
+    open->nrows++;
+    open->bytes += size + 1;
+    return open->bytes >= KILO_SEARCH_SHARD ? NULL : open;
 }
 
-void editorScroll() {
-    CONFIG.rx = 0;
+// Cut the rows from `from` on into shards of about KILO_SEARCH_SHARD bytes
+static void searchSplit(int from){
+    struct searchShard *open = NULL; // shard still taking materialized rows
+    int offset;
+    rownode *node = from < CONFIG.numrows ? editorRowNodeAt(from, &offset) : NULL;
+    int at = from - (node ? offset : 0);
+
+    for(; node; at += node->nlines, offset = 0, node = editorRowNodeNext(node)){
+        if(node->first_line == -1){
+            open = searchAddText(open, at, node->row.chars, node->row.size);
+            continue;
+        }
 
-    if(CONFIG.cy < CONFIG.numrows) {
-        CONFIG.rx = editorRowCxToRx(&CONFIG.row[CONFIG.cy], CONFIG.cx);// Ensure cursor moves properly with tabs
+        open = NULL;
+        int line = node->first_line + offset;
+        int end = node->first_line + node->nlines;
+        while(line < end){
+            // Last line starting within a shard's worth of bytes
+            size_t limit = CONFIG.line_start[line] + KILO_SEARCH_SHARD;
+            int lo = line + 1, hi = end;
+            while(lo < hi){
+                int mid = lo + (hi - lo) / 2;
+                if(CONFIG.line_start[mid] < limit){
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            struct searchShard *shard = searchShardNew(at + line - node->first_line, line);
+            shard->nrows = lo - line;
+            shard->bytes = CONFIG.line_start[lo] - CONFIG.line_start[line];
+            line = lo;
+        }
     }
+}
 
-    if (CONFIG.cy < CONFIG.rowoff) {
-        CONFIG.rowoff = CONFIG.cy;
+/*
+ * Stop the scan, if any, and forget its results
+ */
+void editorSearchStop(){
+    pthread_mutex_lock(&SEARCH.lock);
+    SEARCH.ready = SEARCH.next_shard;
+    while(SEARCH.busy > 0){
+        pthread_cond_wait(&SEARCH.finished, &SEARCH.lock);
     }
-    if (CONFIG.cy >= CONFIG.rowoff + CONFIG.screenrows) {
-        CONFIG.rowoff = CONFIG.cy - CONFIG.screenrows + 1;
+    int i;
+    for(i = 0; i < SEARCH.nshards; i++){
+        free(SEARCH.shards[i].matches);
     }
-    if(CONFIG.rx  < CONFIG.coloff){
-        CONFIG.coloff = CONFIG.cx;
+    SEARCH.nshards = SEARCH.ready = SEARCH.next_shard = 0;
+    SEARCH.done = SEARCH.merged = 0;
+    pthread_mutex_unlock(&SEARCH.lock);
+
+    SEARCH.ntexts = 0;
+    SEARCH.nindex = 0;
+    SEARCH.count = 0;
+    SEARCH.bytes = SEARCH.bytes_done = 0;
+    free(SEARCH.query);
+    SEARCH.query = NULL;
+}
+
+// Search the shards set up for SEARCH.query, right away if they are small
+static void searchRun(){
+    int i;
+    for(i = 0; i < SEARCH.nshards; i++){
+        SEARCH.bytes += SEARCH.shards[i].bytes;
     }
-    if(CONFIG.rx >= CONFIG.coloff + CONFIG.screencols){
-        CONFIG.coloff = CONFIG.cx - CONFIG.screencols + 1;
+    if(SEARCH.bytes <= KILO_SEARCH_SHARD){
+        for(i = 0; i < SEARCH.nshards; i++){
+            searchShardRun(&SEARCH.shards[i]);
+            SEARCH.shards[i].done = 1;
+            SEARCH.count += SEARCH.shards[i].count;
+        }
+        SEARCH.done = SEARCH.nshards;
+        SEARCH.bytes_done = SEARCH.bytes;
+        editorSearchPoll();
+        return;
+    }
+
+    // The pool is started the first time it is needed, and kept. It has at
+    // least one worker even on a single CPU, so typing never waits for it.
+    if(SEARCH.nthreads == 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int n = cpus < 1 ? 1 : (cpus > KILO_SEARCH_THREADS ? KILO_SEARCH_THREADS : cpus);
+        for(i = 0; i < n; i++){
+            if(pthread_create(&SEARCH.threads[i], NULL, searchWorker, NULL) != 0){
+                die("pthread_create");
+            }
+            SEARCH.nthreads++;
+        }
     }
+    pthread_mutex_lock(&SEARCH.lock);
+    SEARCH.ready = SEARCH.nshards;
+    pthread_cond_broadcast(&SEARCH.work);
+    pthread_mutex_unlock(&SEARCH.lock);
 }
 
-void editorSetStatusMessage(const char* fmt, ...){
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(CONFIG.statusmsg, sizeof(CONFIG.statusmsg), fmt, ap);
-    va_end(ap);
-    CONFIG.statusmsg_time = time(NULL);
+/*
+ * Find every match of query in the rows from `from` on, which must all be
+ * indexed. Large buffers are cut into shards that the worker threads search
+ * while the editor keeps going, editorSearchPoll() collects their matches
+ * into the index. No more than a shard's worth of text is searched right
+ * away.
+ */
+void editorSearchStart(const char *query, int from){
+    editorSearchStop();
+    SEARCH.query = strdup(query);
+    editorMatcherInit(&SEARCH.matcher, SEARCH.query);
+    searchSplit(from);
+    searchRun();
 }
 
-void editorDrawMessageBar(struct abuf *ab){
-    abAppend(ab, "\x1b[k", 3);
-    int msglen = strlen(CONFIG.statusmsg);
-    if(msglen > CONFIG.screencols){
-        msglen = CONFIG.screencols;
+/*
+ * Search for a query that extends the one searched last. It can only match
+ * in rows the shorter one matched in, so only the rows in the index are
+ * searched again, plus whatever the last scan had not got to yet.
+ */
+void editorSearchRefine(const char *query){
+    editorSearchPoll();
+    int rest = editorSearchDone() ? CONFIG.numrows : SEARCH.shards[SEARCH.merged].row;
+    int nrows = SEARCH.nindex;
+    int *rows = malloc(sizeof(int) * (nrows ? nrows : 1));
+    if(rows == NULL){
+        die("malloc");
     }
-    if(msglen && time(NULL) - CONFIG.statusmsg_time < 5){
-        abAppend(ab, CONFIG.statusmsg, msglen);
+    int i;
+    for(i = 0; i < nrows; i++){
+        rows[i] = SEARCH.index[i].row;
     }
 
+    editorSearchStop();
+    SEARCH.query = strdup(query);
+    editorMatcherInit(&SEARCH.matcher, SEARCH.query);
+    struct searchShard *open = NULL;
+    for(i = 0; i < nrows; i++){
+        int offset;
+        rownode *node = editorRowNodeAt(rows[i], &offset);
+        if(node->first_line == -1){
+            open = searchAddText(open, rows[i], node->row.chars, node->row.size);
+        } else {
+            int line = node->first_line + offset;
+            open = searchAddText(open, rows[i], &CONFIG.filebuf[CONFIG.line_start[line]], editorLineLength(line));
+        }
+    }
+    free(rows);
+    searchSplit(rest);
+    searchRun();
 }
 
+/*
+ * Block until every shard of the scan is searched
+ */
+void editorSearchWait(){
+    pthread_mutex_lock(&SEARCH.lock);
+    while(SEARCH.done < SEARCH.nshards){
+        pthread_cond_wait(&SEARCH.finished, &SEARCH.lock);
+    }
+    pthread_mutex_unlock(&SEARCH.lock);
+    editorSearchPoll();
+}
 
-/*** input ***/
-void editorMoveCursor(int key){
-    erow *row = (CONFIG.cy >= CONFIG.numrows) ? NULL : &CONFIG.row[CONFIG.cy];
+/*
+ * Move the matches of finished shards into the index. Shards are merged
+ * in row order, so the index is always sorted and holds every match up
+ * to the first shard still being searched. Returns 1 if anything changed.
+ */
+int editorSearchPoll(){
+    pthread_mutex_lock(&SEARCH.lock);
+    int first = SEARCH.merged;
+    while(SEARCH.merged < SEARCH.nshards && SEARCH.shards[SEARCH.merged].done){
+        struct searchShard *shard = &SEARCH.shards[SEARCH.merged++];
+        if(SEARCH.nindex + shard->nmatches > SEARCH.index_cap){
+            while(SEARCH.nindex + shard->nmatches > SEARCH.index_cap){
+                SEARCH.index_cap = SEARCH.index_cap ? SEARCH.index_cap * 2 : 256;
+            }
+            SEARCH.index = realloc(SEARCH.index, sizeof(struct searchMatch) * SEARCH.index_cap);
+            if(SEARCH.index == NULL){
+                die("realloc");
+            }
+        }
+        memcpy(&SEARCH.index[SEARCH.nindex], shard->matches, sizeof(struct searchMatch) * shard->nmatches);
+        SEARCH.nindex += shard->nmatches;
+        free(shard->matches);
+        shard->matches = NULL;
+    }
+    int changed = SEARCH.merged != first || SEARCH.done != SEARCH.merged;
+    pthread_mutex_unlock(&SEARCH.lock);
+    return changed;
+}
 
-    switch(key) {
+int editorSearchDone(){
+    return SEARCH.query && SEARCH.merged == SEARCH.nshards;
+}
 
-    case ARROW_LEFT:
-        if (CONFIG.cx != 0){
-            CONFIG.cx--;
-        } else if (CONFIG.cy > 0){ // Go one row up and to the end of the line
-            CONFIG.cy--;
-            CONFIG.cx = CONFIG.row[CONFIG.cy].size;
-        }
-        break;
-    case ARROW_RIGHT:
-        if(row && CONFIG.cx < row->size){
-            CONFIG.cx++;
-        } else if(row && CONFIG.cx == row->size){
-            CONFIG.cy++;
-            CONFIG.cx = 0;
-        }
-        break;
-    case ARROW_UP:
-        if(CONFIG.cy > 0){
-            CONFIG.cy--;
-        }
-        break;
-    case ARROW_DOWN:
-        if(CONFIG.cy < CONFIG.numrows){
-            CONFIG.cy++;
+/*
+ * Row after (direction 1) or before (-1) `row` with a match, wrapping
+ * around the buffer, from the index of a finished scan. Returns -1 if
+ * there is no match at all.
+ */
+int editorSearchNext(int row, int direction, int *cx){
+    if(SEARCH.nindex == 0) return -1;
+
+    // First entry whose row is past `row` for forward, at or past it for
+    // backward
+    int lo = 0, hi = SEARCH.nindex;
+    while(lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        if(SEARCH.index[mid].row < row + (direction == 1)){
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        break;
     }
+    int i;
+    if(direction == 1){
+        i = lo < SEARCH.nindex ? lo : 0;
+    } else {
+        i = lo > 0 ? lo - 1 : SEARCH.nindex - 1;
+    }
+    *cx = SEARCH.index[i].cx;
+    return SEARCH.index[i].row;
+}
 
-    row = (CONFIG.cy >= CONFIG.numrows) ? NULL : &CONFIG.row[CONFIG.cy];
+/*** find ***/
 
-    int rowlen = row ? row->size : 0;
-    if(CONFIG.cx > rowlen){
-        CONFIG.cx = rowlen;
+// Put the cursor on a match of `len` bytes and highlight it
+static void findJump(int row, int cx, int len){
+    if(SEARCH.hl_row != -1){
+        erow *saved_row = editorRowAt(SEARCH.hl_row);
+        if(saved_row){
+            editorRowInvalidate(saved_row);
+        }
+        SEARCH.hl_row = -1;
     }
+
+    erow *match_row = editorRowAt(row);
+    editorSyntaxAvailable(row + 1);
+    editorRowRender(match_row);
+
+    SEARCH.last_match = row;
+    CONFIG.cy = row;
+    CONFIG.cx = cx;
+    CONFIG.rowoff = CONFIG.numrows;
+
+    SEARCH.hl_row = row;
+    int rx = editorRowCxToRender(match_row, cx);
+    memset(&match_row->hl[rx], HL_MATCH, editorRowCxToRender(match_row, cx + len) - rx);
 }
 
-/*** find ***/
+/*
+ * Pick up what the search workers found, and go to the first match once it
+ * is known. Returns 1 if the screen needs redrawing.
+ */
+int editorFindProgress(){
+    int changed = editorSearchPoll();
+    if(SEARCH.jump_pending && (SEARCH.nindex > 0 || editorSearchDone())){
+        SEARCH.jump_pending = 0;
+        if(SEARCH.nindex > 0){
+            findJump(SEARCH.index[0].row, SEARCH.index[0].cx, SEARCH.matcher.len);
+        }
+        changed = 1;
+    }
+    return changed;
+}
 
 void editorFindCallback(char *query, int key){
-    static int last_match = -1;
-    static int direction = 1;
-
-    static int saved_hl_line;
-    static char* saved_hl = NULL;
+    // The match highlight lives in the render cache, dropping it restores
+    // the normal colours
+    if(SEARCH.hl_row != -1){
+        erow *saved_row = editorRowAt(SEARCH.hl_row);
+        if(saved_row){
+            editorRowInvalidate(saved_row);
+        }
+        SEARCH.hl_row = -1;
+    }
 
-    if(saved_hl){
-        memcpy(CONFIG.row[saved_hl_line].hl, saved_hl, CONFIG.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
+    if(key == '\r' || key == '\x1b'){
+        // Enter keeps the cursor on the first match even if the scan has
+        // not got there yet
+        if(key == '\r' && SEARCH.jump_pending){
+            editorSearchWait();
+            editorFindProgress();
+        }
+        editorSearchStop();
+        SEARCH.last_match = -1;
+        SEARCH.direction = 1;
+        SEARCH.jump_pending = 0;
+        return;
     }
-    
-    if( key == '\r' || key == '\x1b'){
-        last_match = -1;
-        direction = 1;
+
+    if(key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP){
+        SEARCH.direction = (key == ARROW_RIGHT || key == ARROW_DOWN) ? 1 : -1;
+        if(SEARCH.jump_pending){
+            // Arrows move on from the first match, wait until it is known
+            editorSearchWait();
+            editorFindProgress();
+        }
+    } else if(query[0] != '\0'){
+        SEARCH.last_match = -1;
+        SEARCH.direction = 1;
+        SEARCH.jump_pending = 1;
+        // A longer query only needs the rows the shorter one matched in
+        if(SEARCH.query && !strncmp(query, SEARCH.query, strlen(SEARCH.query))){
+            editorSearchRefine(query);
+        } else {
+            editorSearchStart(query, 0);
+        }
+        editorFindProgress();
         return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN){
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP){
-        direction = -1;
     } else {
-        last_match = -1;
-        direction = 1;
+        // Every row matches an empty query
+        editorSearchStop();
+        SEARCH.last_match = -1;
+        SEARCH.jump_pending = 0;
     }
 
-    if (last_match == -1){
-        direction = 1;
+    if(SEARCH.last_match == -1){
+        SEARCH.direction = 1;
     }
-    int current = last_match;
-    int i;
-    for(i = 0; i < CONFIG.numrows; i++){
-        current += direction;
+
+    struct editorMatcher matcher;
+    editorMatcherInit(&matcher, query);
+    int current;
+    int cx = 0;
+    // The index is complete up to the shard still being searched, a next
+    // match inside it is final
+    int indexed = editorSearchDone() || (SEARCH.direction == 1 && SEARCH.last_match != -1 &&
+        SEARCH.nindex > 0 && SEARCH.index[SEARCH.nindex - 1].row > SEARCH.last_match);
+    if(indexed){
+        current = editorSearchNext(SEARCH.last_match, SEARCH.direction, &cx);
+    } else if(SEARCH.last_match == -1){
+        current = editorSearchForward(&matcher, 0, CONFIG.numrows, &cx);
+    } else if(SEARCH.direction == 1){
+        current = editorSearchForward(&matcher, SEARCH.last_match + 1, CONFIG.numrows, &cx);
         if(current == -1){
-            current = CONFIG.numrows - 1;
-        } else if (current == CONFIG.numrows){
-            current = 0;
+            current = editorSearchForward(&matcher, 0, SEARCH.last_match + 1, &cx);
         }
-
-        erow * row = &CONFIG.row[current];
-
-        char *match = strstr(row->render, query);
-        if(match) {
-            last_match = current;
-            CONFIG.cy = current;
-            CONFIG.cx = editorRowRxToCx(row, match - row->render);
-            CONFIG.rowoff = CONFIG.numrows;
-
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
+    } else {
+        current = editorSearchBackward(&matcher, 0, SEARCH.last_match, &cx);
+        if(current == -1){
+            current = editorSearchBackward(&matcher, SEARCH.last_match, CONFIG.numrows, &cx);
         }
     }
+
+    if(current != -1){
+        findJump(current, cx, matcher.len);
+    }
 }
 
 void editorFind(){
+    // Matches can be anywhere, so every line has to be known, and rows
+    // are searched as they are stored
+    editorRowsIndexAll();
+    editorRowGapClose();
+
     int saved_cx = CONFIG.cx;
     int saved_cy = CONFIG.cy;
 
@@ -1159,7 +5128,9 @@ char *editorPrompt(char *prompt,void (*callback)(char *, int)) {
     editorRefreshScreen();
     int c = editorReadKey();
     if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
-      if (buflen != 0) buf[--buflen] = '\0';
+      // Back over a whole UTF-8 sequence
+      while (buflen != 0 && (buf[--buflen] & 0xc0) == 0x80);
+      buf[buflen] = '\0';
     } else if (c == '\x1b') {
       editorSetStatusMessage("");
       if(callback){
@@ -1175,7 +5146,7 @@ char *editorPrompt(char *prompt,void (*callback)(char *, int)) {
         }
         return buf;
       }
-    } else if (!iscntrl(c) && c < 128) {
+    } else if (c < 256 && !iscntrl(c)) {
       if (buflen == bufsize - 1) {
         bufsize *= 2;
         buf = (char *) realloc(buf, bufsize);
@@ -1188,6 +5159,336 @@ char *editorPrompt(char *prompt,void (*callback)(char *, int)) {
     }
   }
 }
+
+/*** goto ***/
+/*
+ * Jump to a line number. Lines past the indexed part are indexed up to it.
+ */
+void editorGotoLine(){
+    char *input = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+    if(input == NULL) return;
+
+    char *end;
+    long line = strtol(input, &end, 10);
+    int valid = *end == '\0' && line >= 1;
+    free(input);
+    if(!valid){
+        editorSetStatusMessage("Not a line number");
+        return;
+    }
+    if(line > INT_MAX){
+        line = INT_MAX;
+    }
+    editorRowsEnsure(line);
+    CONFIG.cy = line <= CONFIG.numrows ? line - 1 : CONFIG.numrows;
+    CONFIG.cx = 0;
+}
+
+/*
+ * Jump to a byte offset of the text, counted from 0 the way compilers and
+ * other tools report them
+ */
+void editorGotoOffset(){
+    char *input = editorPrompt("Go to byte: %s (ESC to cancel)", NULL);
+    if(input == NULL) return;
+
+    char *end;
+    // Always decimal, a leading 0 is not octal
+    unsigned long long offset = strtoull(input, &end, 10);
+    int valid = isdigit((unsigned char) input[0]) && *end == '\0';
+    free(input);
+    if(!valid){
+        editorSetStatusMessage("Not a byte offset");
+        return;
+    }
+    while(rowBytes(CONFIG.rows) <= offset && !editorRowsIndexed()){
+        editorRowsIndexMore(KILO_INDEX_CHUNK);
+    }
+    size_t col;
+    CONFIG.cy = editorRowAtOffset(offset, &col);
+    CONFIG.cx = 0;
+    if(CONFIG.cy < CONFIG.numrows){
+        // An offset inside a character goes to its start
+        CONFIG.cx = rowCharStart(editorRowAt(CONFIG.cy), col);
+    }
+}
+/*** replay ***/
+static long long nowNs(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Length of the keystroke at the start of s: an escape sequence, a whole
+ * bracketed paste, a UTF-8 character or a single byte
+ */
+static int replayKey(const char *s, int len){
+    static const char paste[] = "\x1b[200~";
+    static const char paste_end[] = "\x1b[201~";
+    if(len >= (int) sizeof(paste) - 1 && !memcmp(s, paste, sizeof(paste) - 1)){
+        const char *end = memmem(s, len, paste_end, sizeof(paste_end) - 1);
+        return end ? end - s + (int) sizeof(paste_end) - 1 : len;
+    }
+    if(s[0] == '\x1b' && len >= 3 && s[1] == '['){
+        int j = 2;
+        while(j < len && (s[j] < 0x40 || s[j] > 0x7e)){
+            j++;
+        }
+        return j < len ? j + 1 : len;
+    }
+    if(s[0] == '\x1b' && len >= 3 && s[1] == 'O'){
+        return 3;
+    }
+    unsigned int cp;
+    int n = editorUtf8Decode(s, len, &cp);
+    return n ? n : 1;
+}
+
+// Frames go to the master side of the pty, read here so writes never block
+static void *replayDrain(void *arg){
+    (void) arg;
+    char buf[1 << 16];
+    while(read(REPLAY.master, buf, sizeof(buf)) > 0);
+    return NULL;
+}
+
+// Canned scenarios are generated rather than stored
+static void replayKeys(const char *keys, int times){
+    while(times-- > 0){
+        abAppend(&REPLAY.script, keys, strlen(keys));
+    }
+}
+
+static int replayScenario(const char *name){
+    if(!strcmp(name, "typing")){
+        // Go to the middle of the file and write code there
+        static const char text[] = "for(int i = 0; i < n; i++){ sum += v[i] * 31; } /* \"mix\" */";
+        replayKeys("\x07", 1);
+        replayKeys("100000\r", 1);
+        int i;
+        for(i = 0; i < 4000; i++){
+            if(i % 64 == 63){
+                replayKeys("\r", 1);
+            } else if(i % 50 == 49){
+                replayKeys("\x7f", 1);
+            } else {
+                abAppend(&REPLAY.script, &text[i % (sizeof(text) - 1)], 1);
+            }
+        }
+    } else if(!strcmp(name, "paging")){
+        replayKeys("\x1b[6~", 500);
+        replayKeys("\x1b[B", 500);
+        replayKeys("\x1b[5~", 250);
+        replayKeys("\x1b[F\x1b[H", 50);
+    } else if(!strcmp(name, "search")){
+        // Type the query a key at a time, step through matches, then a
+        // query with none
+        replayKeys("\x06return", 1);
+        replayKeys("\x1b[B", 300);
+        replayKeys("\x1b[A", 50);
+        replayKeys("\r\x06no_such_symbol\x1b", 1);
+    } else if(!strcmp(name, "paste")){
+        struct abuf block = ABUF_INIT;
+        int i;
+        abAppend(&block, "\x1b[200~", 6);
+        for(i = 0; i < 200; i++){
+            char line[80];
+            int len = snprintf(line, sizeof(line), "\tpasted[%d] = lookup(table, \"key %d\"); // copy\n", i, i);
+            abAppend(&block, line, len);
+        }
+        abAppend(&block, "\x1b[201~", 6);
+        for(i = 0; i < 50; i++){
+            abAppend(&REPLAY.script, block.buf, block.len);
+            replayKeys("\x1b[6~", 1);
+        }
+        abFree(&block);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// A file of C that's big enough to matter, removed again once it's open
+static char *replayCorpus(){
+    static const char *lines[] = {
+        "/* block %d: checksum the bytes before they are written */",
+        "static int block_%d(const char *buf, int len){",
+        "\tint sum = 0;",
+        "\tfor(int i = 0; i < len; i++){",
+        "\t\tsum += buf[i] * %d;",
+        "\t}",
+        "\treturn sum ^ 0x%x; // \"done\"",
+        "}",
+        "",
+    };
+    int count = sizeof(lines) / sizeof(lines[0]);
+    char *path = strdup("/tmp/kilo-replay-XXXXXX.c");
+    int fd = mkstemps(path, 2);
+    FILE *fp = fd == -1 ? NULL : fdopen(fd, "w");
+    if(fp == NULL){
+        die("replay corpus");
+    }
+    int i;
+    for(i = 0; i < KILO_REPLAY_LINES; i++){
+        fprintf(fp, lines[i % count], i / count);
+        fputc('\n', fp);
+    }
+    fclose(fp);
+    return path;
+}
+
+static int replayCompare(const void *a, const void *b){
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of a sorted array
+static long long replayPercentile(long long *sorted, int n, int pct){
+    int rank = (n * pct + 99) / 100;
+    return n ? sorted[rank > 0 ? rank - 1 : 0] : 0;
+}
+
+static void replayReport(){
+    int n = REPLAY.frames;
+    long long elapsed = nowNs() - REPLAY.started;
+    long long bytes_total = 0;
+    int i;
+    for(i = 0; i < n; i++){
+        bytes_total += REPLAY.bytes[i];
+    }
+    qsort(REPLAY.latency, n, sizeof(long long), replayCompare);
+    qsort(REPLAY.bytes, n, sizeof(long long), replayCompare);
+
+    fprintf(REPLAY.report, "%s: %d keys, %d frames in %.2f s\n", REPLAY.name, REPLAY.keys, n, elapsed / 1e9);
+    fprintf(REPLAY.report, "  latency us: p50 %.1f p99 %.1f max %.1f\n",
+            replayPercentile(REPLAY.latency, n, 50) / 1e3,
+            replayPercentile(REPLAY.latency, n, 99) / 1e3,
+            replayPercentile(REPLAY.latency, n, 100) / 1e3);
+    fprintf(REPLAY.report, "  bytes/frame: p50 %lld p99 %lld max %lld mean %lld\n",
+            replayPercentile(REPLAY.bytes, n, 50), replayPercentile(REPLAY.bytes, n, 99),
+            replayPercentile(REPLAY.bytes, n, 100), n ? bytes_total / n : 0);
+    fflush(REPLAY.report);
+}
+
+/*
+ * Input of a replay, handed out one keystroke each time the editor reads
+ * with nothing pending. Waits for the rest of an escape sequence get
+ * nothing, like on a terminal the next key comes later. Reports and exits
+ * once the script runs out, or returns -1 to a paste still waiting for its
+ * end marker.
+ */
+int editorReplayRead(char *buf, int size, int timeout_ms){
+    if(REPLAY.pos == REPLAY.step_end){
+        if(timeout_ms > 0) return 0;
+        if(REPLAY.pos == REPLAY.script.len){
+            // A paste with no end marker ends with the script
+            if(timeout_ms < 0) return -1;
+            replayReport();
+            exit(0);
+        }
+        REPLAY.step_end = REPLAY.pos + replayKey(&REPLAY.script.buf[REPLAY.pos], REPLAY.script.len - REPLAY.pos);
+        REPLAY.keys++;
+        // Keys a prompt reads without drawing count towards the next frame
+        if(REPLAY.step_start == 0){
+            REPLAY.step_start = nowNs();
+        }
+    }
+    // A paste bigger than the input buffer comes over several reads
+    int len = REPLAY.step_end - REPLAY.pos;
+    if(len > size){
+        len = size;
+    }
+    memcpy(buf, &REPLAY.script.buf[REPLAY.pos], len);
+    REPLAY.pos += len;
+    return len;
+}
+
+/*
+ * A frame is out, it answers the keys handed out since the last one
+ */
+void editorReplayFrame(){
+    if(REPLAY.step_start == 0) return;
+    if(REPLAY.frames == REPLAY.cap){
+        REPLAY.cap = REPLAY.cap ? REPLAY.cap * 2 : 1024;
+        long long *latency = realloc(REPLAY.latency, REPLAY.cap * sizeof(long long));
+        if(latency == NULL){
+            die("realloc");
+        }
+        REPLAY.latency = latency;
+        long long *bytes = realloc(REPLAY.bytes, REPLAY.cap * sizeof(long long));
+        if(bytes == NULL){
+            die("realloc");
+        }
+        REPLAY.bytes = bytes;
+    }
+    REPLAY.latency[REPLAY.frames] = nowNs() - REPLAY.step_start;
+    REPLAY.bytes[REPLAY.frames] = CONFIG.frame_bytes;
+    REPLAY.frames++;
+    REPLAY.step_start = 0;
+}
+
+/*
+ * Run the editor headless on a pty, fed a keystroke script: one of the
+ * canned scenarios typing, paging, search and paste, or a file of recorded
+ * terminal input. Without a file to open a generated C file is used. Key to
+ * frame latency and frame sizes go to stdout once the script is done.
+ */
+int editorReplay(const char *script, char *filename){
+    REPLAY.name = script;
+    if(replayScenario(script) == -1){
+        FILE *fp = fopen(script, "r");
+        if(fp == NULL){
+            fprintf(stderr, "replay: no scenario or script %s\n", script);
+            return 1;
+        }
+        char buf[4096];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), fp)) > 0){
+            abAppend(&REPLAY.script, buf, n);
+        }
+        fclose(fp);
+    }
+
+    REPLAY.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(REPLAY.master == -1 || grantpt(REPLAY.master) == -1 || unlockpt(REPLAY.master) == -1){
+        die("posix_openpt");
+    }
+    int slave = open(ptsname(REPLAY.master), O_RDWR | O_NOCTTY);
+    if(slave == -1){
+        die("open pty");
+    }
+    struct winsize ws = {KILO_REPLAY_ROWS, KILO_REPLAY_COLS, 0, 0};
+    ioctl(slave, TIOCSWINSZ, &ws);
+
+    // The report keeps the real stdout, the editor gets the pty
+    REPLAY.report = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(slave, STDIN_FILENO);
+    dup2(slave, STDOUT_FILENO);
+    close(slave);
+    pthread_t drain;
+    pthread_create(&drain, NULL, replayDrain, NULL);
+    pthread_detach(drain);
+
+    // Keys never go through the pty, so it needs no raw mode
+    initEditor();
+    editorWindowInit();
+    char *corpus = filename ? NULL : replayCorpus();
+    editorOpen(filename ? filename : corpus);
+    if(corpus){
+        unlink(corpus);
+        free(corpus);
+    }
+    // Nothing of a replay is worth recovering
+    JOURNAL.disabled = 1;
+
+    REPLAY.active = 1;
+    REPLAY.started = nowNs();
+    editorRun();
+    return 0;
+}
+
 /*** Init ***/
 void initEditor(){
 
@@ -1197,13 +5498,58 @@ void initEditor(){
     CONFIG.rowoff = 0;
     CONFIG.coloff = 0;
     CONFIG.numrows = 0;
-    CONFIG.row = NULL;
+    CONFIG.rows = NULL;
+    CONFIG.filebuf = NULL;
+    CONFIG.filesize = 0;
+    CONFIG.filemapped = 0;
+    CONFIG.file_changed = 0;
+    CONFIG.line_start = NULL;
+    CONFIG.line_cr = NULL;
+    CONFIG.line_cap = 0;
+    CONFIG.nlines = 0;
+    CONFIG.index_pos = 0;
+    CONFIG.syntax_valid = 0;
+    memset(CONFIG.mem_free, 0, sizeof(CONFIG.mem_free));
+    CONFIG.mem_used = 0;
+    CONFIG.mem_reserved = 0;
+    CONFIG.gap_row = NULL;
+    CONFIG.gap_at = 0;
+    CONFIG.gap_len = 0;
     CONFIG.dirty = 0;
     CONFIG.filename = NULL;
+    CONFIG.input_pos = 0;
+    CONFIG.input_len = 0;
     CONFIG.statusmsg[0] = '\0';
-    CONFIG.statusmsg_time = 0;
+    memset(CONFIG.timers, 0, sizeof(CONFIG.timers));
     CONFIG.syntax = NULL;
-    
+    CONFIG.lru_head = NULL;
+    CONFIG.lru_tail = NULL;
+    CONFIG.cache_bytes = 0;
+    CONFIG.cache_hits = 0;
+    CONFIG.cache_misses = 0;
+    CONFIG.cache_evictions = 0;
+    CONFIG.frame = 0;
+    CONFIG.screen = NULL;
+    CONFIG.next_frame = NULL;
+    CONFIG.screen_lines = 0;
+    CONFIG.screen_width = 0;
+    CONFIG.screen_valid = 0;
+    CONFIG.screen_cx = CONFIG.screen_cy = 0;
+    CONFIG.frame_bytes = 0;
+    CONFIG.total_bytes = 0;
+    CONFIG.show_stats = 0;
+    editorCacheInit();
+    editorScreenInit();
+    editorWidthInit();
+    editorEventsInit();
+    editorSearchInit();
+    editorJournalInit();
+    editorUndoInit();
+}
+
+// Sizes the editor to the terminal, separate from initEditor() so the
+// editor can also run without one
+void editorWindowInit(){
     if(getWindowSize(&CONFIG.screenrows, &CONFIG.screencols) == -1){
         die("getWindowsize");
     }
@@ -0,0 +1,683 @@
+// The editor core, everything but main(), so other programs such as the
+// benchmarks can link against it
+#ifndef KILO_H
+#define KILO_H
+
+/*** include ***/
+#define _GNU_SOURCE // memmem(), posix_openpt() and friends
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KILO_HAVE_AVX2 1
+#endif
+
+/*** defines ***/
+#define KILO_VERSION "0.0.1"
+#define KILO_TAB_STOP 8
+#define KILO_QUIT_TIMES 3
+#define KILO_INDEX_CHUNK (1 << 20) // bytes of newlines indexed per step
+#define KILO_INDEX_IDLE_MS 20 // time spent indexing whenever input is idle
+#define KILO_CACHE_BUDGET (64 << 20) // default bytes of render/hl to keep
+#define KILO_INPUT_CHUNK (64 << 10) // bytes of terminal input read at once
+#define KILO_WRITE_IOV 1024 // pieces of a file handed to one writev()
+#define KILO_SAVE_BLOCK (1 << 20) // bytes per block of edited rows copied for a save
+#define KILO_JOURNAL_MS 1000 // longest an edit waits in memory before it is synced
+#define KILO_JOURNAL_BUFFER (64 << 10) // bytes of records written out without waiting
+#define JOURNAL_MAGIC "KILOJNL1"
+#define KILO_UNDO_BYTES (32 << 20) // undo history kept, oldest steps go first
+#define KILO_ESC_TIMEOUT_MS 100 // wait for the rest of an escape sequence
+#define KILO_STATUS_MS 5000 // time a status message stays up
+#define KILO_SYNTAX_BUDGET (256 << 10) // bytes a frame lexes ahead of the lexer thread
+#define KILO_SEARCH_THREADS 8 // most worker threads a search runs on
+#define KILO_REPLAY_LINES 200000 // lines of the file a replay makes up to edit
+#define KILO_REPLAY_ROWS 24 // size of the terminal a replay draws on
+#define KILO_REPLAY_COLS 80
+#ifndef KILO_SEARCH_SHARD
+#define KILO_SEARCH_SHARD (1 << 20) // bytes of text a worker takes at once
+#endif
+
+// What editorWait() woke up for
+#define EVENT_INPUT (1<<0)
+#define EVENT_RESIZE (1<<1)
+#define EVENT_SEARCH (1<<2) // search workers finished some shards
+#define EVENT_SYNTAX (1<<3) // the lexer thread got further into the file
+#define EVENT_SAVE (1<<4) // a background save finished
+#define EVENT_FILE (1<<5) // the mapped file shrank on disk
+
+// Row memory: blocks up to 4K come from 64K slabs with one free list per
+// size class. Classes go up in steps of 16 bytes to 256, then in four steps
+// per doubling. Bigger blocks are plain malloc.
+#define ROWMEM_CLASSES 32
+#define ROWMEM_SLAB (64 << 10)
+
+#define HL_HIGHLIGHT_NUMBERS (1<<0)
+#define HL_HIGHLIGHT_STRINGS (1<<1)
+
+// Syntax state carried from the end of one line into the next. Zero is the
+// normal state, a quote character means a string continued with a trailing
+// backslash.
+#define HL_STATE_COMMENT 1
+#define HL_STATE_NONE 0xff // hl_state of a row drawn plain, its state is unknown
+
+// The lexer thread keeps the state of every line of the file buffer, in
+// blocks of this many lines
+#define LEXER_BLOCK_LINES (1 << 16)
+// A span keeps its state before every line that is a multiple of this, so
+// cutting it never lexes more than this many lines
+#define SYNTAX_CHECKPOINT_LINES 1024
+
+
+// What editorRowRender() found in a row, so later passes can skip work
+#define ROW_HAS_TAB (1<<0)
+#define ROW_HAS_CTRL (1<<1) // bytes iscntrl() is true for
+#define ROW_HAS_HIGH (1<<2) // bytes >= 128
+
+// Bytes a frame keeps per screen column, UTF-8 plus a combining mark or two
+#define KILO_CELL_BYTES 8
+
+#define CTRL_KEY(k) ((k) & 0x1f) // Binary & operation
+
+enum editorKey {
+    BACKSPACE = 127,
+    ARROW_LEFT = 1000,
+    ARROW_RIGHT,
+    ARROW_UP,
+    ARROW_DOWN,
+    DEL_KEY,
+    HOME_KEY,
+    END_KEY,
+    PAGE_UP,
+    PAGE_DOWN,
+    PASTE_START // start of a bracketed paste, the text follows
+};
+
+enum editorTimer {
+    TIMER_STATUS, // status message expires
+    TIMER_JOURNAL, // journal records are due to be synced
+    TIMER_COUNT
+};
+
+// Journal records: the op byte, then its fields as varints, then the bytes of
+// a string or the inserted character
+enum journalOp {
+    JOURNAL_INSERT_ROW = 1, // at, len, bytes
+    JOURNAL_DEL_ROW, // at
+    JOURNAL_INSERT_CHAR, // row, at, byte
+    JOURNAL_DEL_CHAR, // row, at
+    JOURNAL_APPEND, // row, len, bytes
+    JOURNAL_TRUNCATE // row, at
+};
+
+// Undo records hold an edit and the text it inserts or removes. Each op is
+// next to its inverse so one bit flips between them.
+enum undoOp {
+    UNDO_INSERT_ROW = 2, // row, text
+    UNDO_DEL_ROW, // row, text
+    UNDO_INSERT_TEXT, // row, at, text
+    UNDO_DEL_TEXT // row, at, text
+};
+#define UNDO_STEP 0x80 // op flag: the first record of an undo step
+
+enum editorHighlight {
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_MLCOMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_STRING,
+    HL_NUMBER,
+    HL_MATCH
+};
+/*** data ***/
+// Slot of a compiled keyword table, word is NULL for an empty slot
+struct editorKeyword{
+    const char* word;
+    int len;
+    unsigned char hl;
+};
+
+struct editorSyntax{
+    char* filetype;
+    char** filematch;
+    char** keywords;
+    char* singleline_comment_start;
+    char* multiline_comment_start;
+    char* multiline_comment_end;
+    int flags;
+    // Filled in by editorSyntaxCompile() the first time the syntax is used
+    struct editorKeyword* kw_table;
+    unsigned int kw_mask;
+    int kw_maxlen;
+};
+// A run of characters that don't take one column and one render byte per
+// byte of chars: tabs wider than a column, and UTF-8 sequences. Characters
+// in a run all have the same length and width, so a position inside one is
+// found by dividing.
+struct rowCheckpoint {
+    int cx; // where the run starts in chars, in columns and in render
+    int rx;
+    int ridx;
+    int count; // characters in the run
+    unsigned char len; // bytes of each in chars
+    unsigned char width; // columns of each
+};
+
+//Editor row, counts size of chars and a buffer of chars
+// render and hl are a cache built from chars, see editorRowRender()
+typedef struct erow{
+    int size;
+    int rsize;
+    int cap; // bytes allocated for chars, at least size + 1
+    int render_cap; // bytes allocated for render
+    char* chars;
+    char* render;
+    unsigned char *hl;
+    struct rowCheckpoint *checkpoints; // built with render, sorted
+    int ncheckpoints;
+    struct erow *lru_prev; // rows with a render cache, most recent first
+    struct erow *lru_next;
+    unsigned int lru_frame; // frame the cache was last used in
+    unsigned char hl_state; // syntax state hl was built from
+    unsigned char render_flags; // ROW_HAS_* bits of chars
+} erow;
+
+// Rows live in a treap keyed by line number (implicit key = position in an
+// in-order walk). A node is either one materialized row, or a span of
+// consecutive lines that still sit untouched in the original file buffer.
+// Spans are cut into single rows only when a row is actually asked for.
+typedef struct rownode{
+    struct rownode *left;
+    struct rownode *right;
+    struct rownode *parent;
+    unsigned int priority;
+    int count;      // number of rows in this subtree
+    size_t bytes;   // bytes of text in this subtree, a newline after each row
+    int nlines;     // rows held by this node, always 1 for a materialized row
+    int first_line; // index into CONFIG.line_start for spans, -1 for a row
+    unsigned char state_in;    // syntax state before the first line
+    unsigned char state_out;   // syntax state after the last line
+    unsigned char state_valid; // the states above are known, see syntax_valid
+    unsigned char *states; // checkpoints of a span, NULL if it needs none, see syntaxCheckpoints()
+    int nstates;
+    erow row;
+} rownode;
+
+struct editorConfig {
+    int cx, cy; //cursor x, cursor y
+    int rx; // screen column of the cursor in its row
+    int rowoff; // row offset, what rowoff of the file the user is currently on
+    int coloff; // column offset
+    int screenrows;
+    int screencols;
+    int numrows;
+    rownode *rows; // root of the row treap
+    char *filebuf; // original contents of the file, spans point into it
+    size_t filesize;
+    int filemapped; // filebuf is a read only mmap rather than malloc'd
+    struct stat filestat; // of the file as it was loaded or last saved
+    volatile sig_atomic_t file_changed; // 1 once the file changed on disk, 2 once that was reported
+    size_t *line_start; // offset of each line in filebuf, plus one past the end
+    size_t *line_cr; // '\r' bytes cut from the lines before each, NULL while there are none
+    size_t line_cap;
+    int nlines;
+    size_t index_pos; // first byte of filebuf whose lines are not indexed yet
+    int syntax_valid; // leading rows whose syntax states are known
+    void *mem_free[ROWMEM_CLASSES]; // free blocks of each row memory class
+    size_t mem_used; // row memory handed out, in whole blocks
+    size_t mem_reserved; // row memory taken from the system
+    erow *gap_row; // row being typed into, its chars have a gap at gap_at
+    int gap_at;
+    int gap_len;
+    erow *lru_head; // rows holding render/hl, most recently used first
+    erow *lru_tail;
+    size_t cache_bytes;
+    size_t cache_budget;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    unsigned long cache_evictions;
+    unsigned int frame; // number of frames drawn so far
+    struct screenLine *screen; // what the terminal shows now
+    struct screenLine *next_frame; // frame being drawn
+    int screen_lines; // size screen and next_frame were made for
+    int screen_width;
+    int screen_valid; // 0 means the terminal state is unknown, redraw it all
+    int screen_cx, screen_cy; // where the cursor was left
+    size_t frame_bytes; // bytes written to the terminal for the last frame
+    unsigned long long total_bytes;
+    int show_stats;
+    int dirty;
+    char *filename;
+    char input[KILO_INPUT_CHUNK]; // terminal input read but not decoded yet
+    int input_pos;
+    int input_len;
+    char statusmsg[80];
+    long long timers[TIMER_COUNT]; // monotonic ms each timer fires at, 0 if unset
+    int signal_pipe[2]; // written to by signal handlers to wake up editorWait()
+    struct editorSyntax *syntax;
+    struct termios orig_termios;
+};
+
+/*** types ***/
+// Append buffer
+// change name to be slightly more meaningful, we're not code golfing this
+struct abuf {
+    char *buf;
+    int len;
+    int cap; // bytes allocated, grows by doubling
+};
+// Constructor for our append buffer
+#define ABUF_INIT {NULL, 0, 0}
+
+// One line of a frame: the bytes shown and the attribute of each byte. An
+// attribute is an HL_* class, plus ATTR_INVERSE for reverse video. The
+// bytes are UTF-8, so cols can be less than len.
+struct screenLine {
+    char *chars;
+    unsigned char *attrs;
+    int len;
+    int cols;
+};
+#define ATTR_INVERSE 0x80
+
+// A search query prepared for editorMatchFirst()/editorMatchLast()
+struct editorMatcher {
+    const char *query;
+    int len;
+    int skip[256]; // Horspool shift for each byte under the last query byte
+};
+
+// First match in a row, the match index holds one for each row that has any
+struct searchMatch {
+    int row;
+    int cx;
+};
+
+// Row as a search worker sees it, when it is not searched as part of a span
+struct searchText {
+    const char *chars;
+    int size;
+    int row;
+};
+
+// Rows a worker searches in one go: lines of a span, or rows described in
+// SEARCH.texts
+struct searchShard {
+    int row;
+    int nrows;
+    int first_line; // line of the first row for spans, -1 for materialized rows
+    int text; // first entry of SEARCH.texts for the other rows
+    size_t bytes;
+    struct searchMatch *matches; // in row order, moved to the index once merged
+    int nmatches;
+    int match_cap;
+    long count; // every match, not just the first of each row
+    int done;
+};
+
+// Whole-buffer search run by a pool of worker threads. Workers only read
+// the snapshot taken by editorSearchStart() plus the file buffer, the rows
+// must not change until editorSearchStop().
+struct editorSearch {
+    struct editorMatcher matcher;
+    char *query; // NULL when no search is running or done
+    struct searchShard *shards;
+    int nshards;
+    int shard_cap;
+    struct searchText *texts;
+    int ntexts;
+    int text_cap;
+    int ready; // shards handed to the workers, the rest are still being set up
+    int next_shard; // next shard a worker picks up
+    int busy; // workers in the middle of a shard
+    int done; // shards finished
+    int merged; // leading shards whose matches were moved to the index
+    struct searchMatch *index; // sorted by row
+    int nindex;
+    int index_cap;
+    long count;
+    size_t bytes;
+    size_t bytes_done;
+    pthread_t threads[KILO_SEARCH_THREADS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // shards were handed out
+    pthread_cond_t finished; // a shard was finished
+    // State of the find prompt
+    int last_match; // row the cursor went to, -1 for none
+    int direction;
+    int hl_row; // row showing the match highlight, -1 for none
+    int jump_pending; // move to the first match once the scan finds it
+};
+
+// A stretch of a save snapshot. A raw one is file buffer text that is left
+// for the saver thread to take the '\r' out of, see saverRaw()
+struct saverPart {
+    const char *s;
+    size_t len;
+    int raw;
+};
+
+// Save running on its own thread. The snapshot is the text of the buffer
+// as pieces: ranges of the file buffer, which never changes while it is
+// mapped, and copies of rows that are not in it. Everything here belongs
+// to the thread until it reports back through the signal pipe.
+struct editorSaver {
+    pthread_t thread;
+    int running;
+    int again; // Ctrl-S came during the save, save once more after it
+    char *target; // file being replaced
+    char *tmp; // file being written, renamed over target when complete
+    mode_t mode;
+    struct saverPart *parts; // the snapshot, turned into pieces by the thread
+    int nparts;
+    int part_cap;
+    struct iovec *pieces;
+    int npieces;
+    int piece_cap;
+    char **blocks; // copied rows
+    int nblocks;
+    int block_cap;
+    size_t block_used; // bytes used of the last block
+    size_t block_size;
+    size_t bytes;
+    int dirty; // CONFIG.dirty when the snapshot was taken
+    int err; // errno of what went wrong, 0 if the save worked
+};
+
+// Edits since the file on disk was written, appended to a hidden file next
+// to it so they can be replayed after a crash
+struct editorJournal {
+    int fd; // -1 until the first edit
+    char *path;
+    struct abuf pending; // records not written to fd yet
+    off_t size; // bytes in the file
+    off_t header_len;
+    off_t snapshot; // first record after the save in progress, -1 if none was written
+    int replaying; // edits come from the journal itself
+    int disabled; // a write failed, nothing more is journaled
+};
+
+struct undoRecord {
+    int op; // 0 if there is no record
+    int step; // first record of its step
+    int row;
+    int at;
+    struct abuf text;
+};
+
+// Undo history: records of the edits made, each followed by its length,
+// grouped into steps that are undone as one. The ones from pos on were
+// undone and can be redone.
+struct editorUndo {
+    struct abuf log;
+    int pos;
+    struct undoRecord open; // last record, still growing while typing goes on
+    int in_command; // the key being handled has recorded an edit
+    int run; // only typing or deleting since the open record was started
+    int dropping; // the step being recorded outgrew the history
+    int applying; // edits come from undo or redo
+};
+
+// A headless run of the editor fed from a keystroke script, see
+// editorReplay()
+struct editorReplay {
+    int active;
+    const char *name;
+    struct abuf script;
+    int pos; // next byte of script to hand out
+    int step_end; // end of the keystroke being handed out
+    int keys;
+    long long step_start; // ns the first key not answered by a frame came in, 0 if none
+    long long started;
+    long long *latency; // ns from key to frame, one per frame that answered keys
+    long long *bytes; // bytes written for those frames
+    int frames;
+    int cap;
+    int master; // pty side the frames come out of
+    FILE *report;
+};
+
+// Lexer thread that works out the syntax state at the start of every line
+// of the file buffer, so the main thread can skip lexing spans. The thread
+// owns everything here except lines_done; the main thread only reads the
+// states of lines below lines_done, and only touches the file buffer and
+// the syntax after editorLexerStop().
+struct editorLexer {
+    pthread_t thread;
+    int running;
+    int stop; // asks the thread to give up
+    const char *buf;
+    size_t len;
+    unsigned char **blocks; // state before each line, LEXER_BLOCK_LINES per block
+    int nblocks;
+    int lines_done; // lines whose state is known, published last
+};
+
+// Escape sequence that switches the terminal to an attribute
+struct attrEscape {
+    char seq[12];
+    int len;
+};
+
+extern struct editorConfig CONFIG;
+extern char *C_HL_extensions[];
+extern char *C_HL_keywords[];
+extern struct editorSyntax HLDB[];
+extern unsigned char SEPARATORS[256];
+extern struct attrEscape ATTR_ESCAPES[256];
+extern unsigned char WIDTH_INDEX[0x110000 >> 8];
+extern unsigned char WIDTH_BLOCKS[256][64];
+extern struct abuf FRAME_OUT;
+extern struct editorSearch SEARCH;
+extern struct editorLexer LEXER;
+extern struct editorSaver SAVER;
+extern struct editorJournal JOURNAL;
+extern struct editorUndo UNDO;
+extern struct editorReplay REPLAY;
+
+/*** Prototypes ***/
+void editorSetStatusMessage(const char* fmt, ...);
+void editorRefreshScreen();
+
+/*** terminal ***/
+void enableRawMode();
+void disableRawMode();
+int editorReadKey();
+int editorInputPending();
+void editorProcessKeyPress();
+int getCursorPosition(int *rows, int *cols);
+int getWindowSize(int * rows, int *cols);
+
+/*** events ***/
+void editorEventsInit();
+int editorWait(int timeout_ms);
+void editorTimerSet(int timer, int ms);
+int editorTimerPending(int timer);
+int editorTimerNext();
+int editorTimersExpire();
+
+/*** syntax highlighting ***/
+int editorUpdateSyntax(erow *row, int state);
+int editorSyntaxTracked();
+void editorSyntaxUpTo(int rows);
+void editorSyntaxAvailable(int rows);
+int editorSyntaxPending();
+void editorLexerStart();
+void editorLexerStop();
+void editorSyntaxUpdate(int at);
+void editorSyntaxReset();
+int editorSyntaxToColor(int hl);
+int is_seperator(int c);
+void editorSyntaxCompile(struct editorSyntax *syntax);
+int editorKeywordLookup(struct editorSyntax *syntax, const char *s, int len);
+void editorSelectSyntaxHighlight();
+
+/*** file i/o ***/
+int editorLoadFile(char* filename);
+int editorFileCheck();
+void editorOpen(char* filename);
+void editorSave();
+int editorSaveFinish();
+void editorSaveWait();
+
+/*** journal ***/
+void editorJournalInit();
+void editorJournalRecord(int op, int row, int at, const char *s, size_t len);
+void editorJournalSync();
+void editorJournalMark();
+void editorJournalRebase(const char *target);
+void editorJournalRecover();
+void editorJournalDiscard();
+
+/*** undo ***/
+void editorUndoInit();
+void editorUndoClear();
+void editorUndoCommand(int run);
+void editorUndoRecord(int op, int row, int at, const char *s, size_t len);
+void editorUndo();
+void editorRedo();
+
+/*** append buffer ***/
+void abAppend(struct abuf *ab, const char* string, int len);
+void abReset(struct abuf *ab);
+int abFlush(struct abuf *ab, int fd);
+void abFree(struct abuf *ab);
+
+/*** screen ***/
+void editorScreenInit();
+void editorScreenResize();
+void editorScreenAppend(int y, const char *s, int len, unsigned char attr);
+void editorScreenAppendSpan(int y, const char *s, const unsigned char *attrs, int len);
+void editorScreenFlush(struct abuf *ab);
+
+/*** search ***/
+void editorMatcherInit(struct editorMatcher *m, const char *query);
+const char *editorMatchFirst(struct editorMatcher *m, const char *s, size_t len);
+const char *editorMatchLast(struct editorMatcher *m, const char *s, size_t len);
+int editorSearchForward(struct editorMatcher *m, int from, int to, int *cx);
+int editorSearchBackward(struct editorMatcher *m, int from, int to, int *cx);
+void editorSearchInit();
+void editorSearchStart(const char *query, int from);
+void editorSearchRefine(const char *query);
+void editorSearchStop();
+void editorSearchWait();
+int editorSearchPoll();
+int editorSearchDone();
+int editorSearchNext(int row, int direction, int *cx);
+
+/*** find ***/
+void editorFindCallback(char *query, int key);
+int editorFindProgress();
+void editorFind();
+
+/*** goto ***/
+void editorGotoLine();
+void editorGotoOffset();
+
+/*** output ***/
+void editorRefreshScreen();
+void editorDrawStatusBar();
+void editorDrawRows();
+void editorDrawRowCells(int y, erow *file_row);
+void editorScroll();
+void editorDrawMessageBar();
+int editorDrawStats(char *buf, int size);
+
+/*** row memory ***/
+void *editorRowAlloc(size_t size, int *cap);
+void *editorRowGrow(void *block, int *cap, size_t size);
+void editorRowFree(void *block, size_t size);
+
+/*** row storage ***/
+erow *editorRowAt(int at);
+int editorRowIndex(erow *row);
+size_t editorRowOffset(int at);
+int editorRowAtOffset(size_t offset, size_t *col);
+rownode *editorRowNodeAt(int at, int *offset);
+rownode *editorRowNodeNext(rownode *node);
+rownode *editorRowNodePrev(rownode *node);
+int editorLineLength(int line);
+void editorRowsWalk(void (*callback)(const char *, int, void *), void *arg);
+void editorRowsForEach(void (*callback)(erow *));
+void editorRowsLoad(char *buf, size_t len, int mapped);
+void editorRowsFree();
+int editorRowsIndexMore(size_t bytes);
+void editorRowsIndexAll();
+void editorRowsEnsure(int rows);
+int editorRowsIndexed();
+
+/*** utf-8 ***/
+void editorWidthInit();
+int editorUtf8Decode(const char *s, int len, unsigned int *cp);
+int editorCharWidth(unsigned int cp);
+int editorCellWidth(const char *s, int len, int *width);
+
+/*** render cache ***/
+void editorRowRender(erow *row);
+void editorRowInvalidate(erow *row);
+void editorCacheInit();
+
+/*** row operations ***/
+void editorRowGapClose();
+void editorUpdateRow(erow *row);
+void editorAppendRow(char* s, size_t len);
+void editorFreeRow(erow *row);
+void editorDelRow(int at);
+int editorRowCxToRx(erow * row, int cx);
+int editorRowRxToCx(erow *row, int rx);
+int editorRowCxToRender(erow *row, int cx);
+void editorRowInsertChar(erow *row, int at, int input);
+void editorRowDelChar(erow *row, int at);
+void editorRowAppendString(erow *row, char *s, size_t len);
+void editorRowTruncate(erow *row, int at);
+
+/*** editor operations ***/
+void editorInsertChar(int input);
+void editorDelChar();
+void editorInsertNewline();
+void editorInsertText(char *s, size_t len);
+
+/*** input ***/
+int editorIdle();
+void editorPaste();
+void editorMoveCursor(int key);
+char *editorPrompt(char* prompt,void (*callback)(char *, int));
+
+/*** replay ***/
+int editorReplayRead(char *buf, int size, int timeout_ms);
+void editorReplayFrame();
+int editorReplay(const char *script, char *filename);
+
+/*** init ***/
+void initEditor();
+void editorWindowInit();
+void editorRun();
+
+// error handling
+
+void die(const char *s);
+
+#endif
@@ -0,0 +1,19 @@
+#include "kilo.h"
+
+/*** init ***/
+int main(int argc, char *argv[]) {
+    if(argc >= 3 && !strcmp(argv[1], "--replay")){
+        return editorReplay(argv[2], argc >= 4 ? argv[3] : NULL);
+    }
+    enableRawMode();
+    initEditor();
+    editorWindowInit();
+
+    // Opening a file may report a recovered journal over this
+    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-f = find | Ctrl-Z/Y = undo/redo");
+    if(argc >= 2){
+        editorOpen(argv[1]); // pass in the first argument as a filename
+    }
+    editorRun();
+    return 0;
+}